@@ -0,0 +1,61 @@
+//
+// Host check of CContactArray and CountContacts() against plain per-slot state.
+//
+//   g++ -std=c++14 -O2 -I HostCheck -I Touch2pad HostCheck/ContactArrayCheck.cpp Touch2pad/Contact.cpp
+//
+#include "internal.h"
+#include "Contact.h"
+#include <random>
+
+int main()
+{
+	std::mt19937 random(1);
+	int nErrors = 0;
+
+	for (int run = 0; run < 1000; run++)
+	{
+		CContactArray contacts;
+		CTouchPoint reference[MAX_TOUCH_POINT] = {};
+
+		for (int step = 0; step < 200; step++)
+		{
+			int slot = (int)(random() % MAX_TOUCH_POINT);
+			CTouchPoint point;
+
+			point.x = (int)(random() % 65536) - 32768;
+			point.y = (int)(random() % 65536) - 32768;
+			point.down = (int)(random() % 2);
+			point.tick = random();
+			point.id = (int)(random() % 256);
+
+			contacts.SetPoint(slot, point);
+			contacts.SetDown(slot, point.down);
+			reference[slot] = point;
+
+			int count = 0;
+
+			for (int i = 0; i < MAX_TOUCH_POINT; i++)
+			{
+				count += reference[i].down ? 1 : 0;
+				if (contacts.IsDown(i) != (reference[i].down ? TRUE : FALSE))
+				{
+					nErrors++;
+				}
+			}
+			if (contacts.GetCount() != count || CountContacts(contacts.DownMask) != __builtin_popcount(contacts.DownMask))
+			{
+				nErrors++;
+			}
+
+			CTouchPoint stored = contacts.GetPoint(slot);
+
+			if (stored.x != point.x || stored.y != point.y || stored.tick != point.tick || stored.id != point.id || stored.down != point.down)
+			{
+				nErrors++;
+			}
+		}
+	}
+
+	printf("CContactArray: %d errors\n", nErrors);
+	return (nErrors == 0) ? 0 : 1;
+}
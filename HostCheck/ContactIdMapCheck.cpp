@@ -0,0 +1,84 @@
+//
+// Host check of CContactIdMap against std::map with random insert and remove sequences.
+//
+//   g++ -std=c++14 -O2 -I HostCheck -I Touch2pad HostCheck/ContactIdMapCheck.cpp Touch2pad/Contact.cpp
+//
+#include "internal.h"
+#include "Contact.h"
+#include <iterator>
+#include <map>
+#include <random>
+
+int main()
+{
+	std::mt19937 random(2);
+	int nErrors = 0;
+
+	for (int run = 0; run < 2000; run++)
+	{
+		CContactIdMap map;
+		std::map<UINT32, int> reference;
+		UINT32 usedSlots = 0;
+
+		for (int step = 0; step < 500; step++)
+		{
+			// Odd runs use few IDs so that they collide, even runs any 32-bit ID.
+			UINT32 id = (run & 1) ? (UINT32)(random() % 40) : (UINT32)random();
+
+			if (random() % 3 == 0 && !reference.empty())
+			{	// An ID which is in the map.
+				auto it = reference.begin();
+
+				std::advance(it, random() % reference.size());
+				id = it->first;
+			}
+
+			if (random() % 2)
+			{
+				int slot = map.Insert(id);
+
+				if (reference.count(id))
+				{
+					nErrors += (slot != reference[id]) ? 1 : 0;
+				}
+				else if (reference.size() == MAX_TOUCH_POINT)
+				{
+					nErrors += (slot != CONTACT_NO_SLOT) ? 1 : 0;
+				}
+				else
+				{	// The lowest free slot.
+					int lowest = 0;
+
+					while (usedSlots & (1u << lowest))
+					{
+						lowest++;
+					}
+					nErrors += (slot != lowest) ? 1 : 0;
+					reference[id] = slot;
+					usedSlots |= (1u << slot);
+				}
+			}
+			else
+			{
+				map.Remove(id);
+				if (reference.count(id))
+				{
+					usedSlots &= ~(1u << reference[id]);
+					reference.erase(id);
+				}
+			}
+
+			for (auto &entry : reference)
+			{
+				nErrors += (map.Lookup(entry.first) != entry.second) ? 1 : 0;
+			}
+			if (!reference.count(id) && map.Lookup(id) != CONTACT_NO_SLOT)
+			{
+				nErrors++;
+			}
+		}
+	}
+
+	printf("CContactIdMap: %d errors\n", nErrors);
+	return (nErrors == 0) ? 0 : 1;
+}
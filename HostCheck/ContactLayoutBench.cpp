@@ -0,0 +1,111 @@
+//
+// Host microbenchmark of the contact storage: the former array of CTouchPoint against
+// CContactArray with one array per field. Both keep the down state in a mask. Times a report
+// update of one slot, and a masked pass over the positions of the contacts which are down.
+//
+//   g++ -std=c++14 -O2 -I HostCheck -I Touch2pad HostCheck/ContactLayoutBench.cpp Touch2pad/Contact.cpp
+//
+#include "internal.h"
+#include "Contact.h"
+#include <chrono>
+#include <random>
+
+#define BENCH_ROUNDS	20000000
+#define BENCH_PATTERNS	1024	// Random slots and masks, reused round robin.
+
+// The layout before: one CTouchPoint per slot.
+class CPointArray
+{
+public:
+	UINT32 DownMask;
+	CTouchPoint points[MAX_TOUCH_POINT];
+
+	void SetPoint(int slot, const CTouchPoint &point)
+	{
+		points[slot] = point;
+	}
+
+	INT32 SumX(UINT32 mask) const
+	{
+		INT32 sum = 0;
+
+		for (int i = 0; i < MAX_TOUCH_POINT; i++)
+		{
+			sum += points[i].x & -(INT32)((mask >> i) & 1);
+		}
+		return sum;
+	}
+};
+
+static INT32 SumX(const CContactArray &contacts, UINT32 mask)
+{
+	INT32 sum = 0;
+
+	for (int i = 0; i < MAX_TOUCH_POINT; i++)
+	{
+		sum += contacts.X[i] & -(INT32)((mask >> i) & 1);
+	}
+	return sum;
+}
+
+static double NsPerRound(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_ROUNDS;
+}
+
+int main()
+{
+	std::mt19937 random(7);
+	int slots[BENCH_PATTERNS];
+	UINT32 masks[BENCH_PATTERNS];
+	CTouchPoint points[BENCH_PATTERNS];
+	static CPointArray before;
+	static CContactArray after;
+	volatile INT32 sink = 0;
+
+	for (int i = 0; i < BENCH_PATTERNS; i++)
+	{
+		slots[i] = (int)(random() % MAX_TOUCH_POINT);
+		masks[i] = (UINT32)random() & ((1u << MAX_TOUCH_POINT) - 1);
+		points[i].x = (int)(random() % 32768);
+		points[i].y = (int)(random() % 32768);
+		points[i].down = 1;
+		points[i].tick = random();
+		points[i].id = slots[i];
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < BENCH_ROUNDS; i++)
+	{
+		before.SetPoint(slots[i & (BENCH_PATTERNS - 1)], points[i & (BENCH_PATTERNS - 1)]);
+		before.DownMask ^= (1u << slots[i & (BENCH_PATTERNS - 1)]);
+	}
+	double updateBefore = NsPerRound(start);
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < BENCH_ROUNDS; i++)
+	{
+		after.SetPoint(slots[i & (BENCH_PATTERNS - 1)], points[i & (BENCH_PATTERNS - 1)]);
+		after.DownMask ^= (1u << slots[i & (BENCH_PATTERNS - 1)]);
+	}
+	double updateAfter = NsPerRound(start);
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < BENCH_ROUNDS; i++)
+	{
+		sink += before.SumX(masks[i & (BENCH_PATTERNS - 1)]);
+	}
+	double scanBefore = NsPerRound(start);
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < BENCH_ROUNDS; i++)
+	{
+		sink += SumX(after, masks[i & (BENCH_PATTERNS - 1)]);
+	}
+	double scanAfter = NsPerRound(start);
+
+	printf("Update of a slot: %.2f ns array of points, %.2f ns array per field.\n", updateBefore, updateAfter);
+	printf("Pass over the down slots: %.2f ns array of points, %.2f ns array per field.\n", scanBefore, scanAfter);
+	printf("Array of points %u bytes, array per field %u bytes.\n", (UINT32)sizeof(CPointArray), (UINT32)sizeof(CContactArray));
+	return 0;
+}
@@ -0,0 +1,157 @@
+//
+// Host replay of touch traffic through the gesture engine on a virtual clock. Replays the trace
+// twice and checks that both runs publish the same output at the same virtual times.
+//
+// The trace is read from the file given on the command line, one report per line:
+//   <time in us> <contact ID> <1 down, 0 up> <x> <y>
+// Lines starting with # are skipped. Without a file, a scripted session of moves, taps, double
+// taps, two finger taps and scrolls is replayed.
+//
+//   g++ -std=c++14 -O2 -I HostCheck -I Touch2pad HostCheck/GestureReplay.cpp Touch2pad/Gesture.cpp Touch2pad/Timer.cpp Touch2pad/Contact.cpp
+//
+#include "internal.h"
+#include "Replay.h"
+#include <random>
+
+#define SESSION_MINUTES		10
+
+static BOOL LoadTrace(const char *pPath, std::vector<TRACE_REPORT> *pTrace)
+{
+	FILE *pFile = fopen(pPath, "r");
+	char line[256];
+
+	if (pFile == NULL)
+	{
+		printf("Can't open %s.\n", pPath);
+		return FALSE;
+	}
+
+	while (fgets(line, sizeof(line), pFile) != NULL)
+	{
+		unsigned long long timeUs;
+		unsigned int contactId, down;
+		int x, y;
+
+		if (line[0] == '#' || sscanf(line, "%llu %u %u %d %d", &timeUs, &contactId, &down, &x, &y) != 5)
+		{
+			continue;
+		}
+		if (!pTrace->empty() && timeUs < pTrace->back().TimeUs)
+		{
+			printf("%s: Reports are not in time order at %llu us.\n", pPath, timeUs);
+			fclose(pFile);
+			return FALSE;
+		}
+
+		TRACE_REPORT report = { timeUs, (UCHAR)contactId, (UCHAR)(down ? TRUE : FALSE), x, y };
+		pTrace->push_back(report);
+	}
+
+	fclose(pFile);
+	return TRUE;
+}
+
+static void ScriptSession(std::vector<TRACE_REPORT> *pTrace)
+{
+	std::mt19937 random(15);
+	CTouchScript script;
+	ULONGLONG timeUs = 100000;
+
+	while (timeUs < (ULONGLONG)SESSION_MINUTES * 60 * 1000000)
+	{
+		INT32 x = 4000 + (INT32)(random() % 20000);
+		INT32 y = 4000 + (INT32)(random() % 20000);
+		ULONGLONG holdUs = 40000 + random() % 80000;
+
+		switch (random() % 6)
+		{
+		case 0:		// Move
+			timeUs = script.Stroke(timeUs, 1, x, y, x + (INT32)(random() % 8000) - 4000, y + (INT32)(random() % 8000) - 4000, 200000 + random() % 400000);
+			break;
+		case 1:		// Tap
+			timeUs = script.Tap(timeUs, 1, x, y, holdUs);
+			break;
+		case 2:		// Double tap
+			timeUs = script.Tap(timeUs, 1, x, y, holdUs);
+			timeUs = script.Tap(timeUs + 80000, 1, x + 20, y - 20, holdUs);
+			break;
+		case 3:		// Two finger tap, released in either order
+			timeUs = script.Tap(timeUs, 2, x, y, holdUs, (random() % 2) ? TRUE : FALSE);
+			break;
+		case 4:		// Scroll
+			timeUs = script.Stroke(timeUs, 2, x, y, x, y + (INT32)(random() % 6000) - 3000, 300000 + random() % 300000);
+			break;
+		default:	// Tap and drag
+			timeUs = script.Tap(timeUs, 1, x, y, holdUs);
+			timeUs = script.Stroke(timeUs + 100000, 1, x, y, x + 3000, y, 500000);
+			break;
+		}
+
+		timeUs += 400000 + random() % 1200000;
+	}
+
+	*pTrace = script.m_Reports;
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<TRACE_REPORT> trace;
+
+	if (argc > 1)
+	{
+		if (!LoadTrace(argv[1], &trace))
+		{
+			return 1;
+		}
+	}
+	else
+	{
+		ScriptSession(&trace);
+	}
+
+	if (trace.empty())
+	{
+		printf("The trace is empty.\n");
+		return 1;
+	}
+
+	CReplay *pFirst = new CReplay();
+	CReplay *pSecond = new CReplay();
+	LARGE_INTEGER start, end;
+	UINT32 nPresses = 0;
+	INT8 buttons = 0;
+
+	QueryPerformanceCounter(&start);
+	pFirst->Run(trace);
+	QueryPerformanceCounter(&end);
+	pSecond->Run(trace);
+
+	for (const REPLAY_EVENT &event : pFirst->m_Events)
+	{
+		nPresses += ((event.Output.u.Buttons & ~buttons) & BUTTON_LEFT) ? 1 : 0;
+		nPresses += ((event.Output.u.Buttons & ~buttons) & BUTTON_RIGHT) ? 1 : 0;
+		buttons = event.Output.u.Buttons;
+	}
+
+	printf("Replayed %u frames, %.1f s of touch time in %.1f ms: %u output events, %u button presses.\n",
+		pFirst->m_nFrames, trace.back().TimeUs / 1e6, (end.QuadPart - start.QuadPart) / 1e6,
+		(UINT32)pFirst->m_Events.size(), nPresses);
+
+	BOOL fSame = (pFirst->m_Events.size() == pSecond->m_Events.size()) ? TRUE : FALSE;
+
+	for (size_t i = 0; fSame && i < pFirst->m_Events.size(); i++)
+	{
+		if (pFirst->m_Events[i].TimeUs != pSecond->m_Events[i].TimeUs ||
+			pFirst->m_Events[i].Output.Value != pSecond->m_Events[i].Output.Value)
+		{
+			printf("The runs differ at event %u.\n", (UINT32)i);
+			fSame = FALSE;
+		}
+	}
+
+	delete pSecond;
+	delete pFirst;
+
+	printf(fSame ? "Both runs are identical.\n" : "Failed.\n");
+	return fSame ? 0 : 1;
+}
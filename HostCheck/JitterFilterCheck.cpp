@@ -0,0 +1,77 @@
+//
+// Host simulation of CJitterFilter: a resting finger with +-1 noise at 100 Hz, then a swipe at
+// 20000 units/s. Prints the output moves of the rest and the lag of the swipe, with the filter
+// off and on.
+//
+//   g++ -std=c++14 -O2 -I HostCheck -I Touch2pad HostCheck/JitterFilterCheck.cpp Touch2pad/Ingress.cpp Touch2pad/Contact.cpp
+//
+#include "internal.h"
+#include "Ingress.h"
+#include <random>
+
+#define REPORT_PERIOD_US	10000
+#define REST_REPORTS		100
+#define SWIPE_REPORTS		50
+#define SWIPE_SPEED			20000	// Units per second.
+
+int main()
+{
+	int restMoves[2] = {};
+	int swipeLag[2] = {};
+
+	for (int enabled = 0; enabled < 2; enabled++)
+	{
+		CJitterFilter filter;
+		std::mt19937 random(3);
+		TOUCH_FRAME frame = {};
+		HID_TOUCH_REPORT *pContact = &frame.Contacts[0];
+		INT32 lastX = 0;
+		INT32 lastY = 0;
+
+		filter.cEnabled = enabled;
+		frame.nContacts = 1;
+		pContact->bStatus = 1;
+		pContact->ContactId = 5;
+
+		for (int i = 0; i < REST_REPORTS; i++)
+		{
+			frame.TimeUs = (ULONGLONG)i * REPORT_PERIOD_US;
+			pContact->wXData = 10000 + (INT32)(random() % 3) - 1;
+			pContact->wYData = 8000 + (INT32)(random() % 3) - 1;
+			filter.Apply(&frame);
+
+			if (i > 0 && (pContact->wXData != lastX || pContact->wYData != lastY))
+			{
+				restMoves[enabled]++;
+			}
+			lastX = pContact->wXData;
+			lastY = pContact->wYData;
+		}
+
+		for (int i = 1; i <= SWIPE_REPORTS; i++)
+		{
+			INT32 rawX = 10000 + i * SWIPE_SPEED / (1000000 / REPORT_PERIOD_US);
+
+			frame.TimeUs = (ULONGLONG)(REST_REPORTS - 1 + i) * REPORT_PERIOD_US;
+			pContact->wXData = rawX;
+			pContact->wYData = 8000;
+			filter.Apply(&frame);
+
+			// Past the start of the swipe the lag is steady.
+			if (i > SWIPE_REPORTS / 4 && rawX - pContact->wXData > swipeLag[enabled])
+			{
+				swipeLag[enabled] = rawX - pContact->wXData;
+			}
+		}
+
+		printf("Filter %s: rest moved %d of %d reports, swipe lags %d units (%d us), %d moves held.\n",
+			enabled ? "on" : "off", restMoves[enabled], REST_REPORTS - 1, swipeLag[enabled],
+			(int)((LONGLONG)swipeLag[enabled] * 1000000 / SWIPE_SPEED), (int)filter.m_nHeld);
+	}
+
+	// The filter must hold nearly all the noise back, and the swipe must not trail by more than a report.
+	BOOL fPass = (restMoves[1] * 10 < restMoves[0] && swipeLag[1] * (1000000 / REPORT_PERIOD_US) <= SWIPE_SPEED) ? TRUE : FALSE;
+
+	printf("%s\n", fPass ? "Passed." : "Failed.");
+	return fPass ? 0 : 1;
+}
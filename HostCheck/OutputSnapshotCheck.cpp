@@ -0,0 +1,137 @@
+//
+// Host stress test of the gesture output snapshot. One thread publishes output states through
+// CGesture::PostGestureEvent() like the gesture thread does, while reader threads take
+// snapshots with GetOutput() like the completion of a read request does. Every field of a
+// published state is derived from its sequence number, so a snapshot mixed from two publishes
+// shows up as a mismatch. The sequence seen by each reader must never go back either. It's only
+// 16 bits, so each snapshot is placed between two reads of the count of finished publishes.
+//
+//   g++ -std=c++14 -O2 -pthread -I HostCheck -I Touch2pad HostCheck/OutputSnapshotCheck.cpp Touch2pad/Gesture.cpp Touch2pad/Timer.cpp Touch2pad/Contact.cpp
+//
+#include "internal.h"
+#include "Gesture.h"
+#include <vector>
+
+#define SNAPSHOT_PUBLISHES	2000000
+#define SNAPSHOT_READERS	3
+
+// Fields of the state with the sequence number. Wheel and Buttons change on every publish too.
+static void StateOf(UINT16 sequence, _Out_ PGESTURE_OUTPUT pOutput)
+{
+	pOutput->u.MouseX = (INT16)(sequence & 0x3FF);
+	pOutput->u.MouseY = (INT16)-(INT16)(sequence >> 6);
+	pOutput->u.Wheel = (INT8)((sequence * 7) & 0x7F);
+	pOutput->u.Buttons = (INT8)(sequence & (BUTTON_LEFT | BUTTON_RIGHT));
+	pOutput->u.Sequence = sequence;
+}
+
+static void OnEvent(void *pContext)
+{
+	(void)pContext;
+}
+
+struct SNAPSHOT_READER
+{
+	UINT32 nReads;
+	UINT32 nTorn;
+	UINT32 nBack;
+};
+
+static void Read(CGesture *pGesture, std::atomic<UINT32> *pnPublished, std::atomic<BOOL> *pfDone, SNAPSHOT_READER *pReader)
+{
+	UINT32 last = 0;
+
+	pReader->nReads = 0;
+	pReader->nTorn = 0;
+	pReader->nBack = 0;
+	while (*pfDone == FALSE)
+	{
+		GESTURE_OUTPUT output;
+		GESTURE_OUTPUT expected;
+		UINT32 before = *pnPublished;
+		UINT32 after;
+		UINT32 sequence;
+
+		pGesture->GetOutput(&output);
+		after = *pnPublished;
+		StateOf(output.u.Sequence, &expected);
+		if (output.Value != expected.Value)
+		{
+			pReader->nTorn++;
+		}
+
+		// The snapshot is one of the publishes from before to after + 1, the one which may be
+		// under way. If the reader was held up for a whole wrap of the sequence, it can't tell.
+		sequence = before + (UINT16)(output.u.Sequence - (UINT16)before);
+		if (after + 1 - before <= MAXUINT16)
+		{
+			if (sequence > after + 1 || sequence < last)
+			{
+				pReader->nBack++;
+			}
+			last = sequence;
+		}
+		pReader->nReads++;
+	}
+}
+
+int main()
+{
+	CVirtualClock clock;
+	CTimerWheel wheel(&clock);
+	CGesture *pGesture = new CGesture(&wheel);
+	std::vector<std::thread> readers;
+	SNAPSHOT_READER results[SNAPSHOT_READERS];
+	std::atomic<UINT32> nPublished(0);
+	std::atomic<BOOL> fDone(FALSE);
+	UINT32 nReads = 0, nTorn = 0, nBack = 0;
+
+	pGesture->SetEventCallback(NULL, OnEvent);
+
+	for (UINT32 r = 0; r < SNAPSHOT_READERS; r++)
+	{
+		readers.push_back(std::thread(Read, pGesture, &nPublished, &fDone, &results[r]));
+	}
+
+	for (UINT32 i = 1; i <= SNAPSHOT_PUBLISHES; i++)
+	{
+		GESTURE_OUTPUT state;
+
+		// PostGestureEvent() numbers the publishes itself, from 1 on.
+		StateOf((UINT16)i, &state);
+		pGesture->CurrentMouseX = state.u.MouseX;
+		pGesture->CurrentMouseY = state.u.MouseY;
+		pGesture->CurrentWheel = state.u.Wheel;
+		pGesture->ButtonState = state.u.Buttons;
+		pGesture->PostGestureEvent();
+		nPublished = i;
+	}
+
+	fDone = TRUE;
+	for (std::thread &reader : readers)
+	{
+		reader.join();
+	}
+
+	for (UINT32 r = 0; r < SNAPSHOT_READERS; r++)
+	{
+		nReads += results[r].nReads;
+		nTorn += results[r].nTorn;
+		nBack += results[r].nBack;
+	}
+
+	GESTURE_OUTPUT last;
+	GESTURE_OUTPUT expected;
+
+	pGesture->GetOutput(&last);
+	StateOf((UINT16)SNAPSHOT_PUBLISHES, &expected);
+	delete pGesture;
+
+	printf("%u publishes, %u snapshots by %u readers: %u torn, %u out of order.\n",
+		SNAPSHOT_PUBLISHES, nReads, SNAPSHOT_READERS, nTorn, nBack);
+
+	BOOL fPassed = (nTorn == 0 && nBack == 0 && last.Value == expected.Value) ? TRUE : FALSE;
+
+	printf(fPassed ? "Passed.\n" : "Failed.\n");
+	return fPassed ? 0 : 1;
+}
@@ -0,0 +1,174 @@
+//
+// Host replay benchmark of the cursor prediction. Replays one finger moves on a virtual clock at
+// several prediction horizons, with the acceleration curve flat at 1x so that the cursor moves
+// exactly as far as the contact. Reports what the prediction gains against what it costs:
+//   Lead:      how far the cursor is ahead of the contact on a steady swipe, in ms of the swipe.
+//              The pipeline delay which the user perceives goes down by as much.
+//   Overshoot: how far the cursor runs past the point where the swipe stops, and how long it
+//              takes to fall back onto the contact.
+//   Sine:      how far the cursor runs past the turning points of a back and forth move.
+// The swipe is also replayed with a device clock which is coarser than the scan, so that pairs
+// of frames share their time. The cursor must never step back on it while the contact moves.
+//
+//   g++ -std=c++14 -O2 -I HostCheck -I Touch2pad HostCheck/PredictionReplay.cpp Touch2pad/Gesture.cpp Touch2pad/Timer.cpp Touch2pad/Contact.cpp
+//
+#include "internal.h"
+#include "Replay.h"
+#include <math.h>
+
+#define SWIPE_START_US		100000
+#define SWIPE_MOVE_US		400000
+#define SWIPE_REST_US		300000		// The contact stays put for this long before it goes up.
+#define SWIPE_VELOCITY		16000		// Units per second. 128 units per scan.
+#define SWIPE_X				4000
+#define SINE_PERIOD_US		500000
+#define SINE_AMPLITUDE		4000
+#define SINE_CENTER			16000
+#define SINE_US				1500000
+#define COARSE_CLOCK_US		(2 * REPLAY_REPORT_PERIOD_US)	// Device clock of the coarse replay.
+
+static const UINT32 s_HorizonsUs[] = { 0, 8000, 16000, 24000, 33000 };
+static const ACCEL_POINT s_FlatCurve[] = { { 0, 256 } };
+
+typedef INT32 (*PFN_PATH)(ULONGLONG timeUs);	// X of the contact, timeUs after the stroke started.
+
+static INT32 SwipePath(ULONGLONG timeUs)
+{
+	ULONGLONG moveUs = (timeUs < SWIPE_MOVE_US) ? timeUs : SWIPE_MOVE_US;
+
+	return SWIPE_X + (INT32)((LONGLONG)SWIPE_VELOCITY * (LONGLONG)moveUs / 1000000);
+}
+
+static INT32 SinePath(ULONGLONG timeUs)
+{
+	return SINE_CENTER + (INT32)lround(SINE_AMPLITUDE * sin(2 * M_PI * (double)timeUs / SINE_PERIOD_US));
+}
+
+typedef struct _CURSOR_SAMPLE
+{
+	ULONGLONG TimeUs;		// From the start of the stroke.
+	INT32 ContactX;
+	INT32 CursorX;
+} CURSOR_SAMPLE;
+
+/*
+	Replay one stroke along the path, one frame per scan. With a coarse clock, the frames carry
+	the time of the device clock, so that two scans in a row share it. Returns the cursor after
+	every frame, as the sum of the moves which the engine published.
+*/
+static std::vector<CURSOR_SAMPLE> ReplayStroke(UINT32 horizonUs, PFN_PATH pfnPath, ULONGLONG durationUs, ULONGLONG clockUs)
+{
+	CReplay *pReplay = new CReplay();
+	std::vector<CURSOR_SAMPLE> samples;
+	INT32 cursorX = pfnPath(0);
+	size_t nEvents = 0;
+
+	pReplay->m_Gesture.cPredictionUs = horizonUs;
+	pReplay->m_Gesture.SetAccelerationCurve(s_FlatCurve, ARRAY_SIZE(s_FlatCurve));
+
+	for (ULONGLONG t = 0; t <= durationUs; t += REPLAY_REPORT_PERIOD_US)
+	{
+		TOUCH_FRAME frame;
+		CURSOR_SAMPLE sample;
+
+		ZeroMemory(&frame, sizeof(frame));
+		frame.TimeUs = SWIPE_START_US + t / clockUs * clockUs;
+		frame.Timestamp = (UINT16)(frame.TimeUs / 100);
+		frame.nContacts = 1;
+		frame.Contacts[0].bStatus = (t < durationUs) ? TRUE : FALSE;
+		frame.Contacts[0].wXData = pfnPath(t);
+		frame.Contacts[0].wYData = 16000;
+		frame.Contacts[0].Timestamp = frame.Timestamp;
+		frame.Contacts[0].nContacts = 1;
+
+		pReplay->RunFrame(&frame);
+
+		for (; nEvents < pReplay->m_Events.size(); nEvents++)
+		{
+			cursorX += pReplay->m_Events[nEvents].Output.u.MouseX;
+		}
+
+		sample.TimeUs = t;
+		sample.ContactX = pfnPath(t);
+		sample.CursorX = cursorX;
+		samples.push_back(sample);
+	}
+
+	delete pReplay;
+	return samples;
+}
+
+int main()
+{
+	BOOL fPassed = TRUE;
+
+	printf("%-8s %9s %15s %10s %16s %15s\n", "Horizon", "Lead", "Stop overshoot", "Settled", "Sine overshoot", "Coarse clock");
+
+	for (UINT32 h = 0; h < ARRAY_SIZE(s_HorizonsUs); h++)
+	{
+		UINT32 horizonUs = s_HorizonsUs[h];
+		std::vector<CURSOR_SAMPLE> swipe = ReplayStroke(horizonUs, SwipePath, SWIPE_MOVE_US + SWIPE_REST_US, REPLAY_REPORT_PERIOD_US);
+		std::vector<CURSOR_SAMPLE> sine = ReplayStroke(horizonUs, SinePath, SINE_US, REPLAY_REPORT_PERIOD_US);
+		std::vector<CURSOR_SAMPLE> coarse = ReplayStroke(horizonUs, SwipePath, SWIPE_MOVE_US + SWIPE_REST_US, COARSE_CLOCK_US);
+		double leadSum = 0;
+		UINT32 nLead = 0;
+		INT32 overshoot = 0;
+		ULONGLONG settledUs = 0;
+		INT32 sineOvershoot = 0;
+		UINT32 nBack = 0;
+
+		// The lead settles after a few scans of the swipe.
+		for (const CURSOR_SAMPLE &sample : swipe)
+		{
+			if (sample.TimeUs >= 100000 && sample.TimeUs < SWIPE_MOVE_US)
+			{
+				leadSum += (double)(sample.CursorX - sample.ContactX) * 1000 / SWIPE_VELOCITY;
+				nLead++;
+			}
+			if (sample.TimeUs >= SWIPE_MOVE_US && sample.TimeUs < SWIPE_MOVE_US + SWIPE_REST_US)
+			{
+				INT32 past = sample.CursorX - sample.ContactX;
+
+				if (past > overshoot)
+				{
+					overshoot = past;
+				}
+				if (past != 0)
+				{
+					settledUs = sample.TimeUs + REPLAY_REPORT_PERIOD_US - SWIPE_MOVE_US;
+				}
+			}
+		}
+
+		for (const CURSOR_SAMPLE &sample : sine)
+		{
+			INT32 past = abs(sample.CursorX - SINE_CENTER) - SINE_AMPLITUDE;
+
+			if (past > sineOvershoot)
+			{
+				sineOvershoot = past;
+			}
+		}
+
+		// Once the contact stops, the cursor falls back onto it, which is no step back.
+		for (size_t i = 1; i < coarse.size() && coarse[i].TimeUs <= SWIPE_MOVE_US; i++)
+		{
+			if (coarse[i].CursorX < coarse[i - 1].CursorX)
+			{
+				nBack++;
+			}
+		}
+
+		printf("%5u ms %6.1f ms %9d units %7.0f ms %10d units %8u back\n",
+			horizonUs / 1000, leadSum / nLead, overshoot, settledUs / 1000.0, sineOvershoot, nBack);
+
+		// The lead may not be more than the horizon, and the cursor has to come back onto the contact.
+		if (leadSum / nLead > horizonUs / 1000.0 + 0.5 || swipe.back().CursorX != swipe.back().ContactX || nBack != 0)
+		{
+			fPassed = FALSE;
+		}
+	}
+
+	printf(fPassed ? "Passed.\n" : "Failed.\n");
+	return fPassed ? 0 : 1;
+}
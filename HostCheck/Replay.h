@@ -0,0 +1,201 @@
+#pragma once
+
+//
+// Replay of touch traffic through CGesture on a virtual clock. Reports with the same time make
+// one frame. The wheel is stepped from one deadline to the next in between the frames, so the
+// ShortTap timeouts and the click timeline run at their exact time, and a replay gives the same
+// output on every run, as fast as the host can process it.
+//
+
+#include "Gesture.h"
+#include <vector>
+
+#define REPLAY_REPORT_PERIOD_US	8000	// Scan period of the scripted contacts, 125 Hz.
+#define REPLAY_SETTLE_US		1000000	// Time run after the last report, so that every timeout fires.
+#define REPLAY_FINGER_SPACING	1500	// Distance in X between the fingers of a scripted gesture.
+
+// One contact report of a touch trace.
+typedef struct _TRACE_REPORT
+{
+	ULONGLONG TimeUs;
+	UCHAR ContactId;
+	UCHAR Down;
+	INT32 X;
+	INT32 Y;
+} TRACE_REPORT;
+
+// One output state which the engine published.
+typedef struct _REPLAY_EVENT
+{
+	ULONGLONG TimeUs;		// Virtual time of the publish.
+	GESTURE_OUTPUT Output;
+} REPLAY_EVENT;
+
+//
+// Builds a touch trace. The reports must be added in time order.
+//
+class CTouchScript
+{
+public:
+	std::vector<TRACE_REPORT> m_Reports;
+
+	void Report(ULONGLONG timeUs, UCHAR contactId, BOOL down, INT32 x, INT32 y)
+	{
+		TRACE_REPORT report = { timeUs, contactId, (UCHAR)down, x, y };
+
+		m_Reports.push_back(report);
+	}
+
+	// Fingers with the IDs 0 to nFingers - 1 which go down at once around (x, y) and stay for
+	// holdUs. They go up one scan apart, the last one first if fReverse. Returns the time of the last release.
+	ULONGLONG Tap(ULONGLONG timeUs, UINT32 nFingers, INT32 x, INT32 y, ULONGLONG holdUs, BOOL fReverse = FALSE)
+	{
+		for (UINT32 i = 0; i < nFingers; i++)
+		{
+			Report(timeUs, (UCHAR)i, TRUE, x + (INT32)i * REPLAY_FINGER_SPACING, y);
+		}
+		for (UINT32 i = 0; i < nFingers; i++)
+		{
+			UINT32 finger = fReverse ? nFingers - 1 - i : i;
+
+			Report(timeUs + holdUs + i * REPLAY_REPORT_PERIOD_US, (UCHAR)finger, FALSE, x + (INT32)finger * REPLAY_FINGER_SPACING, y);
+		}
+		return timeUs + holdUs + (nFingers - 1) * REPLAY_REPORT_PERIOD_US;
+	}
+
+	// Fingers which move together in a straight line, one report each per scan. Returns the time of the release.
+	ULONGLONG Stroke(ULONGLONG timeUs, UINT32 nFingers, INT32 x0, INT32 y0, INT32 x1, INT32 y1, ULONGLONG durationUs)
+	{
+		ULONGLONG t;
+
+		for (t = 0; t < durationUs; t += REPLAY_REPORT_PERIOD_US)
+		{
+			INT32 x = x0 + (INT32)((LONGLONG)(x1 - x0) * (LONGLONG)t / (LONGLONG)durationUs);
+			INT32 y = y0 + (INT32)((LONGLONG)(y1 - y0) * (LONGLONG)t / (LONGLONG)durationUs);
+
+			for (UINT32 i = 0; i < nFingers; i++)
+			{
+				Report(timeUs + t, (UCHAR)i, TRUE, x + (INT32)i * REPLAY_FINGER_SPACING, y);
+			}
+		}
+		for (UINT32 i = 0; i < nFingers; i++)
+		{
+			Report(timeUs + t, (UCHAR)i, FALSE, x1 + (INT32)i * REPLAY_FINGER_SPACING, y1);
+		}
+		return timeUs + t;
+	}
+};
+
+class CReplay
+{
+public:
+	CVirtualClock	m_Clock;
+	CTimerWheel		m_Wheel;
+	CGesture		m_Gesture;
+	LONG			m_PostedWork;
+	std::vector<REPLAY_EVENT> m_Events;
+	UINT32			m_nFrames;
+
+	CReplay() :
+		m_Wheel(&m_Clock),
+		m_Gesture(&m_Wheel),
+		m_PostedWork(0),
+		m_nFrames(0)
+	{
+		m_Gesture.SetEventCallback(this, OnEvent);
+		m_Gesture.SetPostCallback(this, OnPost);
+	}
+
+	// Run the timers due up to timeUs, each one at the time of its expiry, and the work they post.
+	void AdvanceTo(ULONGLONG timeUs)
+	{
+		for (;;)
+		{
+			ULONGLONG tick = m_Wheel.GetNextDueTick();
+
+			if (tick == MAXULONGLONG || tick * 1000 > timeUs)
+			{
+				break;
+			}
+			m_Clock.SetMicroseconds(tick * 1000);
+			RunTimers();
+		}
+
+		m_Clock.SetMicroseconds(timeUs);
+		RunTimers();
+	}
+
+	// A frame as the frame assembler passes it on. Frames may share a time, but not go back.
+	void RunFrame(_In_ const TOUCH_FRAME *pFrame)
+	{
+		AdvanceTo(pFrame->TimeUs);
+		m_Gesture.InjectTouchFrame(pFrame);
+		m_nFrames++;
+	}
+
+	void Run(const std::vector<TRACE_REPORT> &trace)
+	{
+		size_t i = 0;
+
+		while (i < trace.size())
+		{
+			TOUCH_FRAME frame;
+
+			frame.TimeUs = trace[i].TimeUs;
+			frame.Timestamp = (UINT16)(frame.TimeUs / 100);
+			frame.nContacts = 0;
+			while (i < trace.size() && trace[i].TimeUs == frame.TimeUs && frame.nContacts < MAX_TOUCH_POINT)
+			{
+				HID_TOUCH_REPORT *pReport = &frame.Contacts[frame.nContacts++];
+
+				ZeroMemory(pReport, sizeof(*pReport));
+				pReport->bStatus = trace[i].Down;
+				pReport->ContactId = trace[i].ContactId;
+				pReport->wXData = trace[i].X;
+				pReport->wYData = trace[i].Y;
+				pReport->Timestamp = frame.Timestamp;
+				i++;
+			}
+			for (UINT32 j = 0; j < frame.nContacts; j++)
+			{
+				frame.Contacts[j].nContacts = (UCHAR)frame.nContacts;
+			}
+
+			RunFrame(&frame);
+		}
+
+		if (!trace.empty())
+		{
+			AdvanceTo(trace.back().TimeUs + REPLAY_SETTLE_US);
+		}
+	}
+
+private:
+	void RunTimers()
+	{
+		m_Wheel.RunDueTimers();
+		while (m_PostedWork != 0)
+		{
+			LONG work = m_PostedWork;
+
+			m_PostedWork = 0;
+			m_Gesture.RunPostedWork(work);
+		}
+	}
+
+	static void OnEvent(void *pContext)
+	{
+		CReplay *This = (CReplay *)pContext;
+		REPLAY_EVENT event;
+
+		event.TimeUs = This->m_Clock.GetMicroseconds();
+		This->m_Gesture.GetOutput(&event.Output);
+		This->m_Events.push_back(event);
+	}
+
+	// The timers run on the replay thread, so the work is run as soon as the timer returns.
+	static void OnPost(void *pContext, LONG work)
+	{
+		((CReplay *)pContext)->m_PostedWork |= work;
+	}
+};
@@ -0,0 +1,106 @@
+//
+// Host benchmark of CMpscRing with the touch report and the ring size of the driver. 1 to 4
+// producer threads push batches of reports, like completions of 1 to 16 reports would, and one
+// consumer pops them the way the gesture thread drains the ring. Reports entries per second
+// through the ring and the share of the pushes which had to be retried because it was full.
+// The producers spin on the ring, so the numbers only mean something with a core per thread.
+//
+//   g++ -std=c++14 -O2 -pthread -I HostCheck -I Touch2pad HostCheck/RingBench.cpp
+//
+#include "internal.h"
+#include "Ring.h"
+#include <vector>
+
+#define BENCH_RING_SIZE		256		// TOUCH_RING_SIZE
+#define BENCH_ENTRIES		2000000	// Per run, shared by the producers.
+#define BENCH_POP_BATCH		32
+
+typedef CMpscRing<HID_TOUCH_REPORT, BENCH_RING_SIZE> CBenchRing;
+
+static const UINT32 s_Producers[] = { 1, 2, 3, 4 };
+static const UINT32 s_Batches[] = { 1, 4, 16 };
+
+static void Produce(CBenchRing *pRing, UINT32 nEntries, UINT32 nBatch)
+{
+	HID_TOUCH_REPORT batch[16];
+	UINT32 nPushed = 0;
+
+	ZeroMemory(batch, sizeof(batch));
+	while (nPushed < nEntries)
+	{
+		UINT32 nDone = 0;
+		UINT32 n = (nBatch < nEntries - nPushed) ? nBatch : nEntries - nPushed;
+
+		for (UINT32 i = 0; i < n; i++)
+		{
+			batch[i].wXData = (INT32)(nPushed + i);
+		}
+		for (;;)
+		{
+			nDone += pRing->Push(batch + nDone, n - nDone);
+			if (nDone == n)
+			{
+				break;
+			}
+			SwitchToThread();
+		}
+		nPushed += n;
+	}
+}
+
+// Entries per second through the ring.
+static double RunBench(UINT32 nProducers, UINT32 nBatch, double *pRetryShare)
+{
+	CBenchRing *pRing = new CBenchRing();
+	std::vector<std::thread> producers;
+	HID_TOUCH_REPORT entries[BENCH_POP_BATCH];
+	UINT32 nPopped = 0;
+	LARGE_INTEGER start, end;
+
+	QueryPerformanceCounter(&start);
+	for (UINT32 p = 0; p < nProducers; p++)
+	{
+		producers.push_back(std::thread(Produce, pRing, BENCH_ENTRIES / nProducers, nBatch));
+	}
+
+	while (nPopped < BENCH_ENTRIES / nProducers * nProducers)
+	{
+		UINT32 nPop = pRing->Pop(entries, BENCH_POP_BATCH);
+
+		if (nPop == 0)
+		{
+			SwitchToThread();
+		}
+		nPopped += nPop;
+	}
+	QueryPerformanceCounter(&end);
+
+	for (std::thread &producer : producers)
+	{
+		producer.join();
+	}
+
+	*pRetryShare = (double)pRing->m_nOverflows / (nPopped + pRing->m_nOverflows);
+	delete pRing;
+
+	return nPopped * 1e9 / (double)(end.QuadPart - start.QuadPart);
+}
+
+int main()
+{
+	printf("Ring of %u touch reports, %u entries a run, %u hardware threads.\n", BENCH_RING_SIZE, BENCH_ENTRIES, std::thread::hardware_concurrency());
+	printf("%-10s %-6s %16s %10s\n", "Producers", "Batch", "Entries/s", "Retried");
+
+	for (UINT32 p = 0; p < ARRAY_SIZE(s_Producers); p++)
+	{
+		for (UINT32 b = 0; b < ARRAY_SIZE(s_Batches); b++)
+		{
+			double retryShare;
+			double rate = RunBench(s_Producers[p], s_Batches[b], &retryShare);
+
+			printf("%-10u %-6u %13.1f M %9.1f%%\n", s_Producers[p], s_Batches[b], rate / 1e6, retryShare * 100);
+		}
+	}
+
+	return 0;
+}
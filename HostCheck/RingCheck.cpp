@@ -0,0 +1,168 @@
+//
+// Host stress test of CMpscRing. Producer threads push numbered entries in batches of random
+// size into a small ring, and push again what didn't fit. One consumer thread pops them and
+// checks that nothing is lost, duplicated or torn, and that the entries of each producer come
+// out in the order they were pushed. Then the same runs without the retries. In both runs, the
+// entries which Push() refused must be exactly the ones counted in m_nOverflows.
+//
+//   g++ -std=c++14 -O2 -pthread -I HostCheck -I Touch2pad HostCheck/RingCheck.cpp
+//
+#include "internal.h"
+#include "Ring.h"
+#include <random>
+#include <vector>
+
+#define RING_CHECK_SIZE		64		// Small, so that the ring wraps and fills up all the time.
+#define RING_PRODUCERS		4
+#define RING_ENTRIES		1000000	// Per producer.
+#define RING_MAX_BATCH		8
+
+typedef struct _RING_ENTRY
+{
+	UINT32 Producer;
+	UINT32 Number;		// Counts the entries of the producer from 0.
+	UINT32 Check;		// Producer ^ Number ^ 0x5A5A5A5A, to catch a torn entry.
+} RING_ENTRY;
+
+typedef CMpscRing<RING_ENTRY, RING_CHECK_SIZE> CCheckRing;
+
+static void Produce(CCheckRing *pRing, UINT32 producer, BOOL fRetry, UINT32 *pnRefused, UINT32 *pnDropped)
+{
+	std::mt19937 random(producer);
+	RING_ENTRY batch[RING_MAX_BATCH];
+	UINT32 number = 0;
+
+	*pnRefused = 0;
+	*pnDropped = 0;
+	while (number < RING_ENTRIES)
+	{
+		UINT32 nBatch = 1 + random() % RING_MAX_BATCH;
+		UINT32 nDone = 0;
+
+		if (nBatch > RING_ENTRIES - number)
+		{
+			nBatch = RING_ENTRIES - number;
+		}
+		for (UINT32 i = 0; i < nBatch; i++)
+		{
+			batch[i].Producer = producer;
+			batch[i].Number = number + i;
+			batch[i].Check = producer ^ (number + i) ^ 0x5A5A5A5A;
+		}
+
+		do
+		{
+			nDone += pRing->Push(batch + nDone, nBatch - nDone);
+			if (nDone < nBatch)
+			{	// Full. Let the consumer catch up.
+				*pnRefused += nBatch - nDone;
+				if (fRetry == FALSE)
+				{
+					*pnDropped += nBatch - nDone;
+				}
+				SwitchToThread();
+			}
+		} while (fRetry && nDone < nBatch);
+
+		number += nBatch;
+	}
+}
+
+/*
+	One run of the producers against one consumer. With retries every entry must come out, in
+	order per producer. Without, a producer's entries may have gaps, but never go back.
+*/
+static BOOL RunProducers(BOOL fRetry)
+{
+	CCheckRing *pRing = new CCheckRing();
+	std::vector<std::thread> producers;
+	UINT32 nRefused[RING_PRODUCERS];
+	UINT32 nDropped[RING_PRODUCERS];
+	UINT32 nextNumber[RING_PRODUCERS] = {};
+	UINT32 nReceived[RING_PRODUCERS] = {};
+	std::atomic<UINT32> nRunning(RING_PRODUCERS);
+	UINT32 nErrors = 0;
+	UINT32 nRefusedTotal = 0;
+	UINT32 nDroppedTotal = 0;
+	UINT32 nReceivedTotal = 0;
+
+	for (UINT32 p = 0; p < RING_PRODUCERS; p++)
+	{
+		producers.push_back(std::thread([pRing, p, fRetry, &nRefused, &nDropped, &nRunning]()
+		{
+			Produce(pRing, p, fRetry, &nRefused[p], &nDropped[p]);
+			nRunning--;
+		}));
+	}
+
+	for (;;)
+	{
+		RING_ENTRY entries[RING_CHECK_SIZE];
+		BOOL fDone = (nRunning == 0) ? TRUE : FALSE;	// Read before the pop, so no entry is left behind.
+		UINT32 nPop = pRing->Pop(entries, ARRAY_SIZE(entries));
+
+		for (UINT32 i = 0; i < nPop; i++)
+		{
+			const RING_ENTRY *pEntry = &entries[i];
+
+			if (pEntry->Producer >= RING_PRODUCERS || pEntry->Check != (pEntry->Producer ^ pEntry->Number ^ 0x5A5A5A5A))
+			{
+				nErrors++;
+				continue;
+			}
+			if (fRetry ? (pEntry->Number != nextNumber[pEntry->Producer]) : (pEntry->Number < nextNumber[pEntry->Producer]))
+			{
+				nErrors++;
+			}
+			nextNumber[pEntry->Producer] = pEntry->Number + 1;
+			nReceived[pEntry->Producer]++;
+		}
+
+		if (nPop == 0)
+		{
+			if (fDone)
+			{
+				break;
+			}
+			SwitchToThread();
+		}
+	}
+
+	for (std::thread &producer : producers)
+	{
+		producer.join();
+	}
+
+	for (UINT32 p = 0; p < RING_PRODUCERS; p++)
+	{
+		if (nReceived[p] + nDropped[p] != RING_ENTRIES)
+		{
+			nErrors++;
+		}
+		nRefusedTotal += nRefused[p];
+		nDroppedTotal += nDropped[p];
+		nReceivedTotal += nReceived[p];
+	}
+	if ((UINT32)pRing->m_nOverflows != nRefusedTotal || pRing->GetOccupancy() != 0 || pRing->IsEmpty() == FALSE)
+	{
+		nErrors++;
+	}
+
+	printf("%s: %u producers, %u entries received, %u dropped, %u refused and %d counted as overflows, high water %d of %u, %u errors.\n",
+		fRetry ? "With retries" : "Without retries", RING_PRODUCERS, nReceivedTotal, nDroppedTotal,
+		nRefusedTotal, (INT32)pRing->m_nOverflows, (INT32)pRing->m_HighWater, RING_CHECK_SIZE, nErrors);
+
+	delete pRing;
+	return (nErrors == 0) ? TRUE : FALSE;
+}
+
+int main()
+{
+	BOOL fPassed = TRUE;
+
+	fPassed = RunProducers(TRUE) && fPassed;
+	fPassed = RunProducers(FALSE) && fPassed;
+
+	printf(fPassed ? "Passed.\n" : "Failed.\n");
+	return fPassed ? 0 : 1;
+}
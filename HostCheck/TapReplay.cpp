@@ -0,0 +1,168 @@
+//
+// Host replay benchmark of the tap policies. Replays scripted taps on a virtual clock and reports
+// the click latency under each policy: the time from the release of the last finger of a tap
+// to the button press. Each tap is replayed on an engine of its own, so that one tap can't
+// change the outcome of the next. The presses which a tap came out as are checked too.
+// Under WAIT_TIMEOUT a move out of the range of a double tap stops the ShortTap timer, so the
+// tap before it never clicks. That's how the engine always behaved, and why EARLY_COMMIT exists.
+//
+//   g++ -std=c++14 -O2 -I HostCheck -I Touch2pad HostCheck/TapReplay.cpp Touch2pad/Gesture.cpp Touch2pad/Timer.cpp Touch2pad/Contact.cpp
+//
+#include "internal.h"
+#include "Replay.h"
+#include <algorithm>
+#include <random>
+
+#define TAP_GESTURES	2000
+#define TAP_START_US	100000
+
+enum TAP_KIND
+{
+	TAP_ONE_FINGER,			// Left click.
+	TAP_TWO_FINGER,			// Right click. The fingers go up in either order.
+	TAP_THEN_MOVE,			// Left click, then a move which starts out of the range of a double tap.
+	TAP_DOUBLE,				// Left double click, or two clicks if the policy has no double tap.
+	TAP_KIND_MAX
+};
+
+// Button presses which each kind of tap comes out as, by policy.
+static const UINT32 s_ExpectedPresses[TAP_POLICY_MAX][TAP_KIND_MAX] =
+{
+	{ 1, 1, 0, 2 },		// WAIT_TIMEOUT
+	{ 1, 1, 1, 2 },		// EARLY_COMMIT
+	{ 1, 1, 1, 2 },		// NO_DOUBLE_TAP
+};
+
+static const char *s_KindNames[TAP_KIND_MAX] = { "one finger", "two finger", "tap, move", "double tap" };
+static const char *s_PolicyNames[TAP_POLICY_MAX] = { "WAIT_TIMEOUT", "EARLY_COMMIT", "NO_DOUBLE_TAP" };
+
+typedef struct _SCRIPTED_TAP
+{
+	TAP_KIND Kind;
+	ULONGLONG ReleaseUs;	// Last release of the 1st tap.
+	CTouchScript Script;
+} SCRIPTED_TAP;
+
+static void ScriptTaps(std::vector<SCRIPTED_TAP> *pTaps)
+{
+	std::mt19937 random(17);
+
+	pTaps->resize(TAP_GESTURES);
+	for (UINT32 i = 0; i < TAP_GESTURES; i++)
+	{
+		SCRIPTED_TAP *pTap = &(*pTaps)[i];
+		INT32 x = 4000 + (INT32)(random() % 20000);
+		INT32 y = 4000 + (INT32)(random() % 20000);
+		ULONGLONG holdUs = 40000 + random() % 80000;
+
+		pTap->Kind = (TAP_KIND)(i % TAP_KIND_MAX);
+		switch (pTap->Kind)
+		{
+		case TAP_ONE_FINGER:
+			pTap->ReleaseUs = pTap->Script.Tap(TAP_START_US, 1, x, y, holdUs);
+			break;
+		case TAP_TWO_FINGER:
+			pTap->ReleaseUs = pTap->Script.Tap(TAP_START_US, 2, x, y, holdUs, (random() % 2) ? TRUE : FALSE);
+			break;
+		case TAP_THEN_MOVE:
+			// Longer than the ShortTap duration, so that the move isn't a tap of its own.
+			pTap->ReleaseUs = pTap->Script.Tap(TAP_START_US, 1, x, y, holdUs);
+			pTap->Script.Stroke(pTap->ReleaseUs + 60000 + random() % 60000, 1, x - 3000, y, x - 6000, y, 400000);
+			break;
+		default:
+			// Both taps within the ShortTap duration, otherwise it's a tap and hold.
+			holdUs = 40000 + random() % 40000;
+			pTap->ReleaseUs = pTap->Script.Tap(TAP_START_US, 1, x, y, holdUs);
+			pTap->Script.Tap(pTap->ReleaseUs + 40000 + random() % 40000, 1, x + 30, y + 30, holdUs);
+			break;
+		}
+	}
+}
+
+static double Percentile(std::vector<double> &values, UINT32 percentile)
+{
+	if (values.empty())
+	{
+		return 0;
+	}
+	std::sort(values.begin(), values.end());
+	return values[(values.size() - 1) * percentile / 100];
+}
+
+int main()
+{
+	std::vector<SCRIPTED_TAP> taps;
+	BOOL fPassed = TRUE;
+
+	ScriptTaps(&taps);
+
+	printf("Click latency after the release of the tap, in ms:\n");
+	printf("%-14s %-11s %6s %6s %6s %6s   %s\n", "Policy", "Tap", "p50", "p90", "p99", "max", "Came out as expected");
+
+	for (UINT32 policy = 0; policy < TAP_POLICY_MAX; policy++)
+	{
+		std::vector<double> latencies[TAP_KIND_MAX];
+		UINT32 nExpected[TAP_KIND_MAX] = {};
+
+		for (const SCRIPTED_TAP &tap : taps)
+		{
+			CReplay *pReplay = new CReplay();
+			ULONGLONG firstPressUs = 0;
+			UINT32 nPresses = 0;
+			INT8 buttons = 0;
+
+			pReplay->m_Gesture.cTapPolicy = (TAP_POLICY_TYPE)policy;
+			pReplay->Run(tap.Script.m_Reports);
+
+			for (const REPLAY_EVENT &event : pReplay->m_Events)
+			{
+				if (event.Output.u.Buttons & ~buttons)
+				{
+					if (nPresses++ == 0)
+					{
+						firstPressUs = event.TimeUs;
+					}
+				}
+				buttons = event.Output.u.Buttons;
+			}
+			delete pReplay;
+
+			if (nPresses == s_ExpectedPresses[policy][tap.Kind])
+			{
+				nExpected[tap.Kind]++;
+			}
+			if (nPresses != 0)
+			{
+				latencies[tap.Kind].push_back((double)(firstPressUs - tap.ReleaseUs) / 1000);
+			}
+		}
+
+		for (UINT32 kind = 0; kind < TAP_KIND_MAX; kind++)
+		{
+			printf("%-14s %-11s ", (kind == 0) ? s_PolicyNames[policy] : "", s_KindNames[kind]);
+			if (latencies[kind].empty())
+			{
+				printf("%6s %6s %6s %6s", "-", "-", "-", "-");
+			}
+			else
+			{
+				printf("%6.0f %6.0f %6.0f %6.0f", Percentile(latencies[kind], 50), Percentile(latencies[kind], 90),
+					Percentile(latencies[kind], 99), Percentile(latencies[kind], 100));
+			}
+			printf("   %u of %u with %u presses\n", nExpected[kind], TAP_GESTURES / TAP_KIND_MAX, s_ExpectedPresses[policy][kind]);
+
+			if (nExpected[kind] != TAP_GESTURES / TAP_KIND_MAX)
+			{
+				fPassed = FALSE;
+			}
+			// Without double taps, every tap clicks on the release of its last finger.
+			if (policy == TAP_POLICY_NO_DOUBLE_TAP && Percentile(latencies[kind], 100) != 0)
+			{
+				fPassed = FALSE;
+			}
+		}
+	}
+
+	printf(fPassed ? "Passed.\n" : "Failed.\n");
+	return fPassed ? 0 : 1;
+}
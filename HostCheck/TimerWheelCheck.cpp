@@ -0,0 +1,282 @@
+//
+// Host check of the timer wheel.
+//   Accuracy:  timers across all the levels of a wheel on a virtual clock, some of them stopped
+//              or restarted on the way, must fire exactly at their tick, each one once.
+//   Cost:      arming, restarting and stopping a timer, in ns.
+//   Jitter:    timers which restart themselves from their callback on the shared wheel, whose
+//              thread sleeps on the waitable timer. How late they fire depends on the host
+//              scheduler, so it's reported, but only an early or a lost timer fails the check.
+//
+//   g++ -std=c++14 -O2 -I HostCheck -I Touch2pad HostCheck/TimerWheelCheck.cpp Touch2pad/Timer.cpp
+//
+#include "internal.h"
+#include "Timer.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#define ACCURACY_TIMERS		20000
+#define COST_TIMERS			1024
+#define COST_ROUNDS			2000
+#define JITTER_TIMERS		32
+#define JITTER_FIRINGS		50			// Per timer.
+#define JITTER_MAX_DELAY	10			// Milliseconds.
+
+//
+// Accuracy on a virtual clock.
+//
+struct ACCURACY_TIMER
+{
+	CWheelTimer *pTimer;
+	CVirtualClock *pClock;
+	ULONGLONG ExpiryUs;		// 0 if the timer must not fire.
+	ULONGLONG FiredUs;
+	UINT32 nFired;
+};
+
+static void OnAccuracyTimer(void *pContext)
+{
+	ACCURACY_TIMER *pEntry = (ACCURACY_TIMER *)pContext;
+
+	pEntry->FiredUs = pEntry->pClock->GetMicroseconds();
+	pEntry->nFired++;
+}
+
+// Delay of a timer, spread over the levels of the wheel and past the reach of the top one.
+static UINT32 RandomDelay(std::mt19937 &random)
+{
+	static const UINT32 s_Ranges[] = { 1 << TIMER_WHEEL_BITS, 1 << (2 * TIMER_WHEEL_BITS), 1 << (3 * TIMER_WHEEL_BITS), 1 << (3 * TIMER_WHEEL_BITS + 1) };
+
+	return 1 + random() % s_Ranges[random() % ARRAY_SIZE(s_Ranges)];
+}
+
+static BOOL CheckAccuracy()
+{
+	std::mt19937 random(13);
+	CVirtualClock clock(5000);		// Not on a slot boundary.
+	CTimerWheel wheel(&clock);
+	std::vector<ACCURACY_TIMER> entries(ACCURACY_TIMERS);
+	ULONGLONG lastUs = 0;
+	UINT32 nSteps = 0;
+	UINT32 nErrors = 0;
+
+	for (ACCURACY_TIMER &entry : entries)
+	{
+		UINT32 delay = RandomDelay(random);
+
+		entry.pTimer = new CWheelTimer(OnAccuracyTimer, &entry, &wheel);
+		entry.pClock = &clock;
+		entry.FiredUs = 0;
+		entry.nFired = 0;
+		entry.pTimer->Start(delay);
+		entry.ExpiryUs = (clock.GetTick() + delay) * 1000;
+
+		switch (random() % 4)
+		{
+		case 0:		// Stopped before it fires.
+			entry.pTimer->Stop();
+			entry.ExpiryUs = 0;
+			break;
+		case 1:		// Restarted, it fires at the 2nd expiry only.
+			delay = RandomDelay(random);
+			entry.pTimer->Start(delay);
+			entry.ExpiryUs = (clock.GetTick() + delay) * 1000;
+			break;
+		}
+		if (entry.ExpiryUs > lastUs)
+		{
+			lastUs = entry.ExpiryUs;
+		}
+	}
+
+	// Stepped like a replay steps it. A timer still armed after the last expiry is an error.
+	for (;;)
+	{
+		ULONGLONG tick = wheel.GetNextDueTick();
+
+		if (tick == MAXULONGLONG || tick * 1000 > lastUs)
+		{
+			break;
+		}
+		clock.SetMicroseconds(tick * 1000);
+		wheel.RunDueTimers();
+		nSteps++;
+	}
+
+	for (ACCURACY_TIMER &entry : entries)
+	{
+		UINT32 nExpected = (entry.ExpiryUs != 0) ? 1 : 0;
+
+		if (entry.nFired != nExpected || entry.FiredUs != entry.ExpiryUs || entry.pTimer->IsArmed())
+		{
+			nErrors++;
+		}
+		delete entry.pTimer;
+	}
+
+	printf("Accuracy: %u timers up to %.1f h ahead in %u steps, %u fired at the wrong time or not once, late by up to %d us.\n",
+		ACCURACY_TIMERS, lastUs / 3.6e9, nSteps, nErrors, (INT32)wheel.m_MaxLateUs);
+
+	return (nErrors == 0 && wheel.m_MaxLateUs == 0) ? TRUE : FALSE;
+}
+
+//
+// Cost of the O(1) operations.
+//
+static void OnIdleTimer(void *pContext)
+{
+	(void)pContext;
+}
+
+static void MeasureCost()
+{
+	std::mt19937 random(13);
+	CVirtualClock clock;
+	CTimerWheel wheel(&clock);
+	std::vector<CWheelTimer *> timers;
+	std::vector<UINT32> delays(COST_TIMERS);
+	LARGE_INTEGER start, armed, restarted, stopped;
+
+	for (UINT32 i = 0; i < COST_TIMERS; i++)
+	{
+		timers.push_back(new CWheelTimer(OnIdleTimer, NULL, &wheel));
+		delays[i] = RandomDelay(random);
+	}
+
+	LONGLONG armNs = 0, restartNs = 0, stopNs = 0;
+
+	for (UINT32 round = 0; round < COST_ROUNDS; round++)
+	{
+		QueryPerformanceCounter(&start);
+		for (UINT32 i = 0; i < COST_TIMERS; i++)
+		{
+			timers[i]->Start(delays[i]);
+		}
+		QueryPerformanceCounter(&armed);
+		for (UINT32 i = 0; i < COST_TIMERS; i++)
+		{
+			timers[i]->Start(delays[COST_TIMERS - 1 - i]);
+		}
+		QueryPerformanceCounter(&restarted);
+		for (UINT32 i = 0; i < COST_TIMERS; i++)
+		{
+			timers[i]->Stop();
+		}
+		QueryPerformanceCounter(&stopped);
+
+		armNs += armed.QuadPart - start.QuadPart;
+		restartNs += restarted.QuadPart - armed.QuadPart;
+		stopNs += stopped.QuadPart - restarted.QuadPart;
+	}
+
+	for (CWheelTimer *pTimer : timers)
+	{
+		delete pTimer;
+	}
+
+	printf("Cost: arm %.1f ns, restart %.1f ns, stop %.1f ns, with %u timers armed.\n",
+		(double)armNs / COST_ROUNDS / COST_TIMERS, (double)restartNs / COST_ROUNDS / COST_TIMERS,
+		(double)stopNs / COST_ROUNDS / COST_TIMERS, COST_TIMERS);
+}
+
+//
+// Jitter on the shared wheel.
+//
+struct JITTER_TIMER
+{
+	CWheelTimer *pTimer;
+	ULONGLONG ExpiryUs;		// Lower bound of the expiry. The tick may move on during Start().
+	UINT32 nFired;
+	UINT32 nEarly;
+	std::vector<LONGLONG> LateUs;
+	std::mt19937 Random;
+	volatile LONG *pnDone;
+};
+
+static void Restart(JITTER_TIMER *pEntry)
+{
+	UINT32 delay = 1 + pEntry->Random() % JITTER_MAX_DELAY;
+
+	pEntry->ExpiryUs = (pEntry->pTimer->GetTick() + delay) * 1000;
+	pEntry->pTimer->Start(delay);
+}
+
+static void OnJitterTimer(void *pContext)
+{
+	JITTER_TIMER *pEntry = (JITTER_TIMER *)pContext;
+	ULONGLONG nowUs = pEntry->pTimer->GetMicroseconds();
+
+	if (nowUs < pEntry->ExpiryUs)
+	{
+		pEntry->nEarly++;
+	}
+	pEntry->LateUs.push_back((LONGLONG)nowUs - (LONGLONG)pEntry->ExpiryUs);
+
+	if (++pEntry->nFired < JITTER_FIRINGS)
+	{
+		Restart(pEntry);
+	}
+	else
+	{
+		InterlockedIncrement(pEntry->pnDone);
+	}
+}
+
+static BOOL MeasureJitter()
+{
+	std::vector<JITTER_TIMER> entries(JITTER_TIMERS);
+	std::vector<LONGLONG> late;
+	volatile LONG nDone = 0;
+	UINT32 nEarly = 0;
+	UINT32 nFired = 0;
+	ULONGLONG startMs = GetTickCount64();
+
+	for (UINT32 i = 0; i < JITTER_TIMERS; i++)
+	{
+		JITTER_TIMER *pEntry = &entries[i];
+
+		pEntry->pTimer = new CWheelTimer(OnJitterTimer, pEntry);	// On the shared wheel.
+		pEntry->nFired = 0;
+		pEntry->nEarly = 0;
+		pEntry->Random.seed(i);
+		pEntry->pnDone = &nDone;
+		Restart(pEntry);
+	}
+
+	// At most 10 ms a firing, with a lot of room for a slow host.
+	while (nDone < JITTER_TIMERS && GetTickCount64() - startMs < 10 * JITTER_FIRINGS * JITTER_MAX_DELAY)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	for (JITTER_TIMER &entry : entries)
+	{
+		delete entry.pTimer;		// Stops the timer, and the last one destroys the shared wheel.
+		nEarly += entry.nEarly;
+		nFired += entry.nFired;
+		late.insert(late.end(), entry.LateUs.begin(), entry.LateUs.end());
+	}
+
+	std::sort(late.begin(), late.end());
+	if (late.empty())
+	{
+		late.push_back(0);
+	}
+	printf("Jitter: %u of %u firings, %u early, late by p50 %lld us, p99 %lld us, max %lld us.\n",
+		nFired, JITTER_TIMERS * JITTER_FIRINGS, nEarly, (long long)late[late.size() / 2],
+		(long long)late[(late.size() - 1) * 99 / 100], (long long)late.back());
+
+	return (nFired == JITTER_TIMERS * JITTER_FIRINGS && nEarly == 0) ? TRUE : FALSE;
+}
+
+int main()
+{
+	BOOL fPassed = TRUE;
+
+	fPassed = CheckAccuracy() && fPassed;
+	MeasureCost();
+	fPassed = MeasureJitter() && fPassed;
+
+	printf(fPassed ? "Passed.\n" : "Failed.\n");
+	return fPassed ? 0 : 1;
+}
@@ -0,0 +1,388 @@
+#pragma once
+
+//
+// Stand-in for Touch2pad/Internal.h, so that the sources of the touch path and the timer wheel
+// build on a host without the WDK. Put this directory before Touch2pad on the include path.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+typedef int BOOL;
+typedef int8_t INT8;
+typedef int16_t INT16;
+typedef unsigned char UCHAR;
+typedef unsigned char BYTE;
+typedef uint16_t UINT16;
+typedef int32_t INT32;
+typedef uint32_t UINT32;
+typedef int64_t INT64;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef uint32_t DWORD;
+typedef void *PVOID;
+typedef void *LPVOID;
+typedef void *HANDLE;
+typedef const wchar_t *LPCWSTR;
+
+#define TRUE	1
+#define FALSE	0
+#define MAXINT32	INT32_MAX
+#define MAXUINT16	UINT16_MAX
+#define MAXULONGLONG	UINT64_MAX
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Inout_
+#define _Out_writes_(x)
+#define _Out_writes_to_(x, y)
+#define _In_reads_(x)
+#define WINAPI
+#define DECLSPEC_ALIGN(x)	alignas(x)
+#define SYSTEM_CACHE_ALIGNMENT_SIZE	64
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
+#endif
+
+#define TRACE_LEVEL_ERROR		2
+#define TRACE_LEVEL_WARNING		3
+#define TRACE_LEVEL_INFORMATION	4
+#define TRACE_LEVEL_VERBOSE		5
+#define Trace(level, ...)		((void)0)
+
+#define ZeroMemory(p, size)			memset((p), 0, (size))
+#define MoveMemory(dst, src, size)	memmove((dst), (src), (size))
+
+// Must match Touch2pad/Internal.h.
+#define MAX_MOUSE_X		32768
+#define MAX_MOUSE_Y		32768
+
+typedef union
+{
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER *pFrequency)
+{
+	pFrequency->QuadPart = 1000000000;
+	return TRUE;
+}
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER *pCounter)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pCounter->QuadPart = (LONGLONG)now.tv_sec * 1000000000 + now.tv_nsec;
+	return TRUE;
+}
+
+inline ULONGLONG GetTickCount64()
+{
+	LARGE_INTEGER counter;
+
+	QueryPerformanceCounter(&counter);
+	return (ULONGLONG)counter.QuadPart / 1000000;
+}
+
+//
+// Interlocked operations, full barriers like on Windows.
+//
+#define MemoryBarrier()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+inline LONG InterlockedIncrement(volatile LONG *pValue)
+{
+	return __atomic_add_fetch(pValue, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedDecrement(volatile LONG *pValue)
+{
+	return __atomic_sub_fetch(pValue, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedExchangeAdd(volatile LONG *pValue, LONG value)
+{
+	return __atomic_fetch_add(pValue, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedExchange(volatile LONG *pValue, LONG value)
+{
+	return __atomic_exchange_n(pValue, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedCompareExchange(volatile LONG *pValue, LONG exchange, LONG comparand)
+{
+	__atomic_compare_exchange_n(pValue, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comparand;
+}
+
+inline LONGLONG InterlockedExchange64(volatile LONGLONG *pValue, LONGLONG value)
+{
+	return __atomic_exchange_n(pValue, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONGLONG InterlockedCompareExchange64(volatile LONGLONG *pValue, LONGLONG exchange, LONGLONG comparand)
+{
+	__atomic_compare_exchange_n(pValue, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comparand;
+}
+
+//
+// Locks.
+//
+typedef struct
+{
+	std::recursive_mutex *pLock;
+} CRITICAL_SECTION;
+
+inline BOOL InitializeCriticalSectionAndSpinCount(CRITICAL_SECTION *pSection, DWORD spinCount)
+{
+	(void)spinCount;
+	pSection->pLock = new std::recursive_mutex();
+	return TRUE;
+}
+
+inline void EnterCriticalSection(CRITICAL_SECTION *pSection)
+{
+	pSection->pLock->lock();
+}
+
+inline void LeaveCriticalSection(CRITICAL_SECTION *pSection)
+{
+	pSection->pLock->unlock();
+}
+
+inline void DeleteCriticalSection(CRITICAL_SECTION *pSection)
+{
+	delete pSection->pLock;
+	pSection->pLock = NULL;
+}
+
+typedef struct
+{
+	std::mutex Lock;
+} SRWLOCK;
+
+#define SRWLOCK_INIT	{}
+
+inline void AcquireSRWLockExclusive(SRWLOCK *pLock)
+{
+	pLock->Lock.lock();
+}
+
+inline void ReleaseSRWLockExclusive(SRWLOCK *pLock)
+{
+	pLock->Lock.unlock();
+}
+
+//
+// Threads, events and waitable timers, as far as the timer wheel thread uses them. All of them
+// share one lock and one condition variable, which is simple and fast enough for a host check.
+//
+#define INFINITE			0xFFFFFFFF
+#define WAIT_OBJECT_0		0
+#define WAIT_TIMEOUT		258
+#define TIMER_ALL_ACCESS	0
+
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID lpParam);
+
+struct HOST_OBJECT
+{
+	BOOL fManualReset;
+	BOOL fSignaled;
+	LONGLONG DueNs;			// QueryPerformanceCounter() value when a waitable timer fires. 0: Not set.
+	std::thread Thread;
+};
+
+inline std::mutex &HostWaitLock()
+{
+	static std::mutex lock;
+	return lock;
+}
+
+inline std::condition_variable &HostWaitSignal()
+{
+	static std::condition_variable signal;
+	return signal;
+}
+
+inline LONGLONG HostNow()
+{
+	LARGE_INTEGER counter;
+
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+}
+
+inline HANDLE CreateEvent(void *pAttributes, BOOL fManualReset, BOOL fInitialState, LPCWSTR pName)
+{
+	HOST_OBJECT *pObject = new HOST_OBJECT();
+
+	(void)pAttributes;
+	(void)pName;
+	pObject->fManualReset = fManualReset;
+	pObject->fSignaled = fInitialState;
+	pObject->DueNs = 0;
+	return pObject;
+}
+
+inline HANDLE CreateWaitableTimer(void *pAttributes, BOOL fManualReset, LPCWSTR pName)
+{
+	return CreateEvent(pAttributes, fManualReset, FALSE, pName);
+}
+
+inline HANDLE CreateWaitableTimerEx(void *pAttributes, LPCWSTR pName, DWORD flags, DWORD access)
+{
+	(void)flags;
+	(void)access;
+	return CreateWaitableTimer(pAttributes, FALSE, pName);
+}
+
+inline BOOL SetEvent(HANDLE hEvent)
+{
+	std::lock_guard<std::mutex> lock(HostWaitLock());
+
+	((HOST_OBJECT *)hEvent)->fSignaled = TRUE;
+	HostWaitSignal().notify_all();
+	return TRUE;
+}
+
+// Only relative due times, in 100 ns units, and one-shot timers.
+inline BOOL SetWaitableTimer(HANDLE hTimer, const LARGE_INTEGER *pDueTime, LONG period, void *pfnCompletion, void *pContext, BOOL fResume)
+{
+	std::lock_guard<std::mutex> lock(HostWaitLock());
+	HOST_OBJECT *pObject = (HOST_OBJECT *)hTimer;
+
+	(void)period;
+	(void)pfnCompletion;
+	(void)pContext;
+	(void)fResume;
+	pObject->fSignaled = FALSE;
+	pObject->DueNs = HostNow() - pDueTime->QuadPart * 100;
+	HostWaitSignal().notify_all();
+	return TRUE;
+}
+
+inline DWORD WaitForMultipleObjects(DWORD nCount, const HANDLE *pHandles, BOOL fWaitAll, DWORD milliseconds)
+{
+	std::unique_lock<std::mutex> lock(HostWaitLock());
+	LONGLONG timeoutNs = (milliseconds == INFINITE) ? 0 : HostNow() + (LONGLONG)milliseconds * 1000000;
+
+	(void)fWaitAll;
+	for (;;)
+	{
+		LONGLONG now = HostNow();
+		LONGLONG wakeNs = timeoutNs;
+
+		for (DWORD i = 0; i < nCount; i++)
+		{
+			HOST_OBJECT *pObject = (HOST_OBJECT *)pHandles[i];
+
+			if (pObject->DueNs != 0 && pObject->DueNs <= now)
+			{
+				pObject->DueNs = 0;
+				pObject->fSignaled = TRUE;
+			}
+			if (pObject->fSignaled)
+			{
+				if (pObject->fManualReset == FALSE)
+				{
+					pObject->fSignaled = FALSE;
+				}
+				return WAIT_OBJECT_0 + i;
+			}
+			if (pObject->DueNs != 0 && (wakeNs == 0 || pObject->DueNs < wakeNs))
+			{
+				wakeNs = pObject->DueNs;
+			}
+		}
+
+		if (timeoutNs != 0 && now >= timeoutNs)
+		{
+			return WAIT_TIMEOUT;
+		}
+
+		if (wakeNs == 0)
+		{
+			HostWaitSignal().wait(lock);
+		}
+		else
+		{
+			HostWaitSignal().wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::nanoseconds(wakeNs)));
+		}
+	}
+}
+
+inline DWORD WaitForSingleObject(HANDLE hObject, DWORD milliseconds)
+{
+	return WaitForMultipleObjects(1, &hObject, FALSE, milliseconds);
+}
+
+// The thread handle is signaled when the thread returns, like on Windows.
+inline HANDLE CreateThread(void *pAttributes, size_t stackSize, LPTHREAD_START_ROUTINE pfnStart, LPVOID lpParam, DWORD flags, DWORD *pThreadId)
+{
+	HOST_OBJECT *pObject = (HOST_OBJECT *)CreateEvent(pAttributes, TRUE, FALSE, NULL);
+
+	(void)stackSize;
+	(void)flags;
+	(void)pThreadId;
+	pObject->Thread = std::thread([pObject, pfnStart, lpParam]()
+	{
+		(*pfnStart)(lpParam);
+		SetEvent(pObject);
+	});
+	return pObject;
+}
+
+inline BOOL CloseHandle(HANDLE hObject)
+{
+	HOST_OBJECT *pObject = (HOST_OBJECT *)hObject;
+
+	if (pObject->Thread.joinable())
+	{
+		pObject->Thread.join();
+	}
+	delete pObject;
+	return TRUE;
+}
+
+inline DWORD GetCurrentThreadId()
+{
+	static std::atomic<DWORD> s_NextId(1);
+	static thread_local DWORD s_Id = s_NextId++;
+
+	return s_Id;
+}
+
+inline BOOL SwitchToThread()
+{
+	std::this_thread::yield();
+	return TRUE;
+}
+
+// Must match the report of Touch2pad/Internal.h.
+#pragma pack(push, 1)
+typedef struct _HID_TOUCH_REPORT
+{
+	UCHAR ReportID;
+	UCHAR  bStatus;
+	UCHAR  ContactId;
+	INT32 wXData;
+	INT32 wYData;
+	UINT32 Padding;
+	UINT16 Timestamp;
+	UCHAR  nContacts;
+} HID_TOUCH_REPORT, *PHID_TOUCH_REPORT;
+#pragma pack(pop)
@@ -0,0 +1,79 @@
+#pragma once
+
+//
+// Time source of the gesture engine and its timers.
+//
+class CClock
+{
+public:
+	virtual ~CClock()
+	{
+	}
+
+	virtual ULONGLONG GetMicroseconds() = 0;
+
+	ULONGLONG GetTick()		// Milliseconds.
+	{
+		return GetMicroseconds() / 1000;
+	}
+};
+
+//
+// Monotonic microseconds on QueryPerformanceCounter(), counted from the creation of the clock.
+//
+class CSystemClock : public CClock
+{
+private:
+	LONGLONG m_QpcFrequency;
+	LONGLONG m_QpcBase;
+
+public:
+	CSystemClock()
+	{
+		LARGE_INTEGER counter;
+
+		QueryPerformanceFrequency(&counter);
+		m_QpcFrequency = counter.QuadPart;
+		QueryPerformanceCounter(&counter);
+		m_QpcBase = counter.QuadPart;
+	}
+
+	virtual ULONGLONG GetMicroseconds()
+	{
+		LARGE_INTEGER counter;
+
+		QueryPerformanceCounter(&counter);
+		return (ULONGLONG)((counter.QuadPart - m_QpcBase) * 1000000 / m_QpcFrequency);
+	}
+};
+
+//
+// Clock which only moves when it's told to. A timer wheel on this clock is stepped from one
+// deadline to the next, so that recorded touch traffic is replayed as fast as it can be
+// processed, with the same results on every run.
+//
+class CVirtualClock : public CClock
+{
+private:
+	ULONGLONG m_NowUs;
+
+public:
+	CVirtualClock(ULONGLONG startUs = 0) :
+		m_NowUs(startUs)
+	{
+	}
+
+	virtual ULONGLONG GetMicroseconds()
+	{
+		return m_NowUs;
+	}
+
+	// Time never goes back, an earlier time is ignored.
+	void SetMicroseconds(ULONGLONG nowUs)
+	{
+		if (nowUs > m_NowUs)
+		{
+			m_NowUs = nowUs;
+		}
+	}
+};
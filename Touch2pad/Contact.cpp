@@ -0,0 +1,146 @@
+#include "internal.h"
+#if defined(EVENT_TRACING)
+#include "contact.tmh"
+#endif
+#include "Contact.h"
+
+UINT32 GetDistance(int a, int b)
+{
+	if (a >= b)
+	{
+		return a - b;
+	}
+	else
+	{
+		return b - a;
+	}
+}
+
+ULONG GetDistance(CTouchPoint a, CTouchPoint b)
+{
+	ULONG distance;
+
+	distance = GetDistance(a.x, b.x) + GetDistance(a.y, b.y);
+	return distance;
+}
+
+//
+// Implementions of CContactArray.
+//
+CContactArray::CContactArray()
+{
+	DownMask = 0;
+	for (int i = 0; i < MAX_TOUCH_POINT; i++)
+	{
+		X[i] = 0;
+		Y[i] = 0;
+		Id[i] = 0;
+		Tick[i] = 0;
+	}
+}
+
+CTouchPoint CContactArray::GetPoint(int slot) const
+{
+	CTouchPoint point;
+
+	point.x = X[slot];
+	point.y = Y[slot];
+	point.down = IsDown(slot);
+	point.tick = Tick[slot];
+	point.id = Id[slot];
+	return point;
+}
+
+void CContactArray::SetPoint(int slot, const CTouchPoint &point)
+{
+	X[slot] = point.x;
+	Y[slot] = point.y;
+	Id[slot] = point.id;
+	Tick[slot] = point.tick;
+}
+
+//
+// Implementions of CContactIdMap.
+//
+CContactIdMap::CContactIdMap()
+{
+	Clear();
+}
+
+void CContactIdMap::Clear()
+{
+	for (int i = 0; i < CONTACT_ID_MAP_SIZE; i++)
+	{
+		m_Entries[i].Id = 0;
+		m_Entries[i].Slot = CONTACT_NO_SLOT;
+	}
+	m_FreeSlots = (1u << MAX_TOUCH_POINT) - 1;
+}
+
+UINT32 CContactIdMap::Find(UINT32 id) const
+{
+	UINT32 i = Hash(id);
+
+	// There are fewer contacts than entries, so the probe always ends at an empty entry.
+	while (m_Entries[i].Slot != CONTACT_NO_SLOT && m_Entries[i].Id != id)
+	{
+		i = (i + 1) & (CONTACT_ID_MAP_SIZE - 1);
+	}
+	return i;
+}
+
+int CContactIdMap::Lookup(UINT32 id) const
+{
+	return m_Entries[Find(id)].Slot;
+}
+
+int CContactIdMap::Insert(UINT32 id)
+{
+	UINT32 i = Find(id);
+
+	if (m_Entries[i].Slot != CONTACT_NO_SLOT)
+	{
+		return m_Entries[i].Slot;
+	}
+
+	if (m_FreeSlots == 0)
+	{
+		return CONTACT_NO_SLOT;
+	}
+
+	int slot = CountContacts((m_FreeSlots & (0u - m_FreeSlots)) - 1);	// Lowest free slot.
+
+	m_FreeSlots &= ~(1u << slot);
+	m_Entries[i].Id = id;
+	m_Entries[i].Slot = slot;
+	return slot;
+}
+
+/*
+	Empty the entry of id, then move the later entries of its probe sequence back into the hole
+	unless their own probe starts after it. So lookups never see a hole, and no tombstones pile up.
+*/
+void CContactIdMap::Remove(UINT32 id)
+{
+	UINT32 i = Find(id);
+
+	if (m_Entries[i].Slot == CONTACT_NO_SLOT)
+	{
+		return;
+	}
+
+	m_FreeSlots |= (1u << m_Entries[i].Slot);
+
+	for (UINT32 j = (i + 1) & (CONTACT_ID_MAP_SIZE - 1); m_Entries[j].Slot != CONTACT_NO_SLOT; j = (j + 1) & (CONTACT_ID_MAP_SIZE - 1))
+	{
+		UINT32 home = Hash(m_Entries[j].Id);
+
+		// The entry at j can fill the hole at i if its home is not in between, i.e. not in (i, j].
+		if (((j - home) & (CONTACT_ID_MAP_SIZE - 1)) >= ((j - i) & (CONTACT_ID_MAP_SIZE - 1)))
+		{
+			m_Entries[i] = m_Entries[j];
+			i = j;
+		}
+	}
+	m_Entries[i].Slot = CONTACT_NO_SLOT;
+}
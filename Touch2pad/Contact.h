@@ -0,0 +1,111 @@
+#pragma once
+
+#define MAX_TOUCH_POINT	10
+
+class CTouchPoint
+{
+public:
+	int x;
+	int y;
+	int down;
+	ULONGLONG tick;		// Device time of the report in microseconds.
+	int id;
+};
+
+// Get 1-dimension distance
+UINT32 GetDistance(int a, int b);
+// Get 2-dimension distance
+ULONG GetDistance(CTouchPoint a, CTouchPoint b);
+
+// Number of bits set in a contact mask.
+inline int CountContacts(UINT32 mask)
+{
+	mask = mask - ((mask >> 1) & 0x55555555);
+	mask = (mask & 0x33333333) + ((mask >> 2) & 0x33333333);
+	return (int)((((mask + (mask >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+}
+
+//
+// Contacts by slot, one array per field. The state of the slots is the DownMask. A slot holds
+// a finger on the pad only while its bit is set, the fields of the other slots are stale and
+// never read. So a report updates one slot and one bit, and releasing all the contacts clears
+// the mask only.
+//
+class CContactArray
+{
+public:
+	UINT32 DownMask;
+	INT32 X[MAX_TOUCH_POINT];
+	INT32 Y[MAX_TOUCH_POINT];
+	INT32 Id[MAX_TOUCH_POINT];
+	ULONGLONG Tick[MAX_TOUCH_POINT];
+
+public:
+	CContactArray();
+
+	CTouchPoint GetPoint(int slot) const;
+	void SetPoint(int slot, const CTouchPoint &point);	// Doesn't change the DownMask.
+
+	BOOL IsDown(int slot) const
+	{
+		return (DownMask & (1u << slot)) ? TRUE : FALSE;
+	}
+
+	void SetDown(int slot, BOOL down)
+	{
+		if (down)
+		{
+			DownMask |= (1u << slot);
+		}
+		else
+		{
+			DownMask &= ~(1u << slot);
+		}
+	}
+
+	int GetCount() const
+	{
+		return CountContacts(DownMask);
+	}
+};
+
+//
+// Maps the contact IDs of the device to the slots of a CContactArray, so that devices which
+// number their contacts sparsely or beyond MAX_TOUCH_POINT work too. A contact takes the lowest
+// free slot when it goes down and gives it back when it's up, so the 1st finger gets slot 0.
+// Open addressing with linear probing in a fixed table, nothing is allocated.
+//
+#define CONTACT_ID_MAP_BITS	4
+#define CONTACT_ID_MAP_SIZE	(1 << CONTACT_ID_MAP_BITS)	// More entries than slots keep the probes short.
+#define CONTACT_NO_SLOT		(-1)
+
+class CContactIdMap
+{
+private:
+	struct ID_ENTRY
+	{
+		UINT32 Id;
+		INT32 Slot;		// CONTACT_NO_SLOT if the entry is empty.
+	};
+
+	ID_ENTRY	m_Entries[CONTACT_ID_MAP_SIZE];
+	UINT32		m_FreeSlots;	// Mask of the slots which no contact has.
+
+	static UINT32 Hash(UINT32 id)
+	{
+		return (id * 0x9E3779B1) >> (32 - CONTACT_ID_MAP_BITS);
+	}
+
+	UINT32 Find(UINT32 id) const;	// Index of the entry of id, or of the empty entry which ends its probe.
+
+public:
+	CContactIdMap();
+
+	void Clear();
+	int Lookup(UINT32 id) const;	// Slot of id, or CONTACT_NO_SLOT.
+	int Insert(UINT32 id);			// Slot of id, a new one if needed. CONTACT_NO_SLOT if all the slots are taken.
+	void Remove(UINT32 id);			// The slot of id is free again.
+};
+
+static_assert(CONTACT_ID_MAP_SIZE > MAX_TOUCH_POINT, "The contact ID map always needs an empty entry.");
+static_assert(MAX_TOUCH_POINT < 32, "The contacts must fit in the down mask.");
@@ -4,130 +4,152 @@
 #endif
 #include "Gesture.h"
 
-UINT32 GetDistance(int a, int b)
+//
+// Transitions of the gesture state machine, indexed by [GESTURE_STATE_TYPE][GESTURE_EVENT_TYPE].
+// The action runs after the state moved to the next state.
+//
+#define GT(action, next)	{ GESTURE_ACTION_##action, GESTURE_STATE_##next }
+
+// The ShortTap timeouts decide the gesture the same way in every state.
+#define GESTURE_TIMEOUTS \
+	GT(NONE, ONE_FINGER_MOVE), GT(LEFT_CLICK, NONE), GT(LEFT_PRESS, ONE_FINGER_DOUBLE_TAP_HOLD), GT(LEFT_DOUBLE_CLICK, NONE), \
+	GT(NONE, TWO_FINGER_MOVE), GT(RIGHT_CLICK, NONE), GT(RIGHT_CLICK_PRESS, TWO_FINGER_DOUBLE_TAP), GT(LEFT_DOUBLE_CLICK, TWO_FINGER_DOUBLE_TAP)
+
+static constexpr GESTURE_TRANSITION s_GestureTransitions[][GESTURE_EVENT_MAX] =
 {
-	if (a >= b)
-	{
-		return a - b;
-	}
-	else
-	{
-		return b - a;
-	}
-}
+	//											ONE_FINGER_RELEASE					TWO_FINGER_RELEASE					FOUR_FINGER_RELEASE
+	/* NONE */						{ GESTURE_TIMEOUTS,	GT(NONE, NONE),						GT(NONE, NONE),						GT(TOGGLE, TOGGLE) },
+	/* ONE_FINGER_MOVE */			{ GESTURE_TIMEOUTS,	GT(NONE, NONE),						GT(NONE, ONE_FINGER_MOVE),			GT(TOGGLE, TOGGLE) },
+	/* ONE_FINGER_SINGLE_TAP */		{ GESTURE_TIMEOUTS,	GT(NONE, ONE_FINGER_SINGLE_TAP),	GT(NONE, ONE_FINGER_SINGLE_TAP),	GT(TOGGLE, TOGGLE) },
+	/* ONE_FINGER_DOUBLE_TAP */		{ GESTURE_TIMEOUTS,	GT(NONE, ONE_FINGER_DOUBLE_TAP),	GT(NONE, ONE_FINGER_DOUBLE_TAP),	GT(TOGGLE, TOGGLE) },
+	/* ONE_FINGER_DOUBLE_TAP_HOLD */{ GESTURE_TIMEOUTS,	GT(LEFT_RELEASE, NONE),				GT(NONE, ONE_FINGER_DOUBLE_TAP_HOLD),	GT(TOGGLE, TOGGLE) },
+	/* TWO_FINGER_SINGLE_TAP */		{ GESTURE_TIMEOUTS,	GT(NONE, TWO_FINGER_SINGLE_TAP),	GT(NONE, TWO_FINGER_SINGLE_TAP),	GT(TOGGLE, TOGGLE) },
+	/* TWO_FINGER_DOUBLE_TAP */		{ GESTURE_TIMEOUTS,	GT(NONE, TWO_FINGER_DOUBLE_TAP),	GT(RIGHT_RELEASE, NONE),			GT(TOGGLE, TOGGLE) },
+	/* TWO_FINGER_MOVE */			{ GESTURE_TIMEOUTS,	GT(NONE, TWO_FINGER_MOVE),			GT(NONE, NONE),						GT(TOGGLE, TOGGLE) },
+	/* LEFT_EDGE */					{ GESTURE_TIMEOUTS,	GT(NONE, LEFT_EDGE),				GT(NONE, LEFT_EDGE),				GT(TOGGLE, TOGGLE) },
+	/* RIGHT_EDGE */				{ GESTURE_TIMEOUTS,	GT(NONE, RIGHT_EDGE),				GT(NONE, RIGHT_EDGE),				GT(TOGGLE, TOGGLE) },
+	/* TOP_EDGE */					{ GESTURE_TIMEOUTS,	GT(NONE, TOP_EDGE),					GT(NONE, TOP_EDGE),					GT(TOGGLE, TOGGLE) },
+	/* BOTTOM_EDGE */				{ GESTURE_TIMEOUTS,	GT(NONE, BOTTOM_EDGE),				GT(NONE, BOTTOM_EDGE),				GT(TOGGLE, TOGGLE) },
+	/* TOGGLE */					{ GESTURE_TIMEOUTS,	GT(NONE, TOGGLE),					GT(NONE, TOGGLE),					GT(TOGGLE, TOGGLE) },
+};
 
-ULONG GetDistance(CTouchPoint a, CTouchPoint b)
+#undef GESTURE_TIMEOUTS
+#undef GT
+
+static_assert(ARRAY_SIZE(s_GestureTransitions) == GESTURE_STATE_MAX, "Every gesture state needs a row of transitions.");
+static_assert(GESTURE_EVENT_TWO_FINGER_HOLD == GESTURE_EVENT_ONE_FINGER_HOLD + 4, "Timeout events are indexed by the tap count.");
+
+
+//
+// Default acceleration curve. Slow moves are passed 1:1, then the gain ramps up to the 4x and
+// 8x of fast moves instead of jumping at fixed speeds.
+//
+static const ACCEL_POINT s_DefaultAccelCurve[] =
+{
+	{ 0,	256 },		// 1x
+	{ 96,	256 },
+	{ 192,	1024 },		// 4x
+	{ 800,	1024 },
+	{ 1200,	2048 },		// 8x
+};
+
+static_assert(ARRAY_SIZE(s_DefaultAccelCurve) <= MAX_ACCEL_POINTS, "Too many points in the default acceleration curve.");
+
+/*
+	Scale a move by a gain in 1/256. The fraction which doesn't make a whole output unit is kept
+	in *pRemainder and added to the next move, so that slow moves are not lost.
+	The product is taken in 64 bits, a gain up to MAXUINT16 overflows 32 bits on long moves.
+	The result is limited to the output range, which a larger move saturates anyway.
+*/
+static INT32 ApplyAccelGain(INT32 move, INT32 gain, _Inout_ INT32 *pRemainder)
 {
-	ULONG distance;
+	LONGLONG scaled = (LONGLONG)move * gain + *pRemainder;
+	LONGLONG result = scaled >> ACCEL_GAIN_SHIFT;	// Rounds down, the remainder is never negative.
 
-	distance = GetDistance(a.x, b.x) + GetDistance(a.y, b.y);
-	return distance;
+	*pRemainder = (INT32)(scaled & ((1 << ACCEL_GAIN_SHIFT) - 1));
+
+	if (result > MAX_MOUSE_X) result = MAX_MOUSE_X;
+	if (result < -MAX_MOUSE_X) result = -MAX_MOUSE_X;
+
+	return (INT32)result;
 }
 
+/*
+	Distance which a contact covers in horizonUs, extrapolated from its velocity, and from the
+	change of its velocity over the last dtUs. The change may add or take at most as much as the
+	velocity itself, so that noise can't turn the prediction around. A contact which reversed is
+	not extrapolated, the cursor would overshoot into the old direction.
+*/
+static INT32 PredictAxis(INT32 velocity, INT32 lastVelocity, ULONGLONG dtUs, UINT32 horizonUs)
+{
+	if ((velocity < 0 && lastVelocity > 0) || (velocity > 0 && lastVelocity < 0))
+	{
+		return 0;
+	}
+
+	LONGLONG move = (LONGLONG)velocity * horizonUs / 1000000;
+	LONGLONG change = (LONGLONG)(velocity - lastVelocity) * horizonUs / (LONGLONG)dtUs * horizonUs / 2000000;
+	LONGLONG limit = (move < 0) ? -move : move;
+
+	if (change > limit) change = limit;
+	if (change < -limit) change = -limit;
+
+	return (INT32)(move + change);
+}
 
 //
 // Implementions of CShortTapTimer.
 //
-CShortTapTimer::CShortTapTimer()
+CShortTapTimer::CShortTapTimer(_In_opt_ CTimerWheel *pWheel) :
+	m_WheelTimer(OnWheelTimer, this, pWheel)
 {
-	HANDLE			m_TimerThread;
-
-#if TIMER_EMULATION
-	m_Count = 0;
-#else
 	m_TickCount = 0;
-#endif
 	m_Threshold = 0;
 	m_pfnCallback = NULL;
-
-	m_TimerThread = CreateThread(0, 0, TimerThread, this, 0, 0);
-	CloseHandle(m_TimerThread);
-
-	m_StartEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_Context = NULL;
 };
 
 CShortTapTimer::~CShortTapTimer()
 {
-	CloseHandle(m_StartEvent);
+	m_WheelTimer.Stop();
 }
 
-DWORD WINAPI CShortTapTimer::TimerThread(LPVOID lpParam)
+void CShortTapTimer::OnWheelTimer(void *pContext)
 {
-	UNREFERENCED_PARAMETER(lpParam);
+	CShortTapTimer *This = (CShortTapTimer *)pContext;
+	PFN_SHORT_TAP_CALLBACK pfnCallback = This->m_pfnCallback;
 
-	CShortTapTimer *This = (CShortTapTimer *)lpParam;
-
-	Trace(TRACE_LEVEL_INFORMATION, "TimerThread started...\n");
-
-	for (;;)
+	if (pfnCallback != NULL)
 	{
-#if TIMER_EMULATION /* Timer emulation for source-level debugging. */
-		Sleep(1);
-		if (This->m_Threshold != 0)
-		{
-			This->IncrementTimer();
-			if (This->m_Count >= This->m_Threshold)
-			{
-				This->StopTimer();
-				(*This->m_pfnCallback)(This->m_Context);
-			}
-		}
-#else
-		DWORD dwWait = 0;
-
-		dwWait = WaitForSingleObject(This->m_StartEvent, INFINITE);
-		if (dwWait != WAIT_OBJECT_0)
-		{
-			Trace(TRACE_LEVEL_ERROR, "TimerThread: Error in WaitForSingleObject.\n");
-		}
-		Sleep(This->m_Threshold);
-		if (This->m_pfnCallback != NULL)
-		{
-			// Run call-back function only if the timer is still active.
-			(*This->m_pfnCallback)(This->m_Context);
-		}
-#endif
+		// Run call-back function only if the timer is still active.
+		(*pfnCallback)(This->m_Context);
 	}
-
-	return 0;
 }
 
+/*
+	Start or restart the timer. Restarting takes the timer off the wheel first, so the
+	previous duration never fires.
+*/
 void CShortTapTimer::StartTimer(UINT32 threshold, PFN_SHORT_TAP_CALLBACK callback, PVOID context)
 {
-#if TIMER_EMULATION
-	m_Count = 0;
-#else
-	m_TickCount = GetTickCount64();
-#endif
+	m_TickCount = m_WheelTimer.GetTick();
 	m_Threshold = threshold;
 	m_pfnCallback = callback;
 	m_Context = context;
 
-	if (FALSE == SetEvent(m_StartEvent))
-	{
-		Trace(TRACE_LEVEL_ERROR, "StartTimer: Error in SetEvent().");
-	};
+	m_WheelTimer.Start(threshold);
 }
 
 
 void CShortTapTimer::StopTimer()
 {
-#if TIMER_EMULATION
-	m_Count = 0;
-#else
+	m_WheelTimer.Stop();
+
 	m_TickCount = 0;
-#endif
 	m_Threshold = 0;
 	m_pfnCallback = NULL;
 }
 
-#if TIMER_EMULATION
-void CShortTapTimer::IncrementTimer()
-{
-	m_Count+=1;
-}
-#endif
-
 /* returns TRUE if the timer is expired or stopped. */
 BOOL CShortTapTimer::IsStopped()
 {
@@ -136,17 +158,15 @@ BOOL CShortTapTimer::IsStopped()
 		return TRUE;	// Default state with no timer set is considered as stopped.
 	}
 
-#if TIMER_EMULATION
-	if (m_Count >= m_Threshold)
-	{
-		return TRUE;	// Timer is expired.
-	}
-#else
-	if (GetTickCount64() - m_TickCount >= m_Threshold)
+	return IsExpired();
+}
+
+BOOL CShortTapTimer::IsExpired()
+{
+	if (m_Threshold != 0 && m_WheelTimer.GetTick() - m_TickCount >= m_Threshold)
 	{
-		return TRUE;	// Timer is expired.
+		return TRUE;
 	}
-#endif
 	else
 	{
 		return FALSE;
@@ -156,136 +176,263 @@ BOOL CShortTapTimer::IsStopped()
 //
 // Implementions of CGesture.
 //
-CGesture::CGesture()
+CGesture::CGesture(_In_opt_ CTimerWheel *pWheel) :
+	m_ShortTapTimer(pWheel),
+	m_ButtonEventTimer(OnButtonEventTimer, this, pWheel)
 {
 	PreviousTouchpadX = PreviousTouchpadY = 0;
 	PreviousContactState = 0;
 	LastTouchpadPressure = 0;
 	LastTouchTick = 0;
-	CurrentMouseX = CurrentMouseX = 0;
+	m_RemainderX = m_RemainderY = 0;
+	m_PredictX = m_PredictY = 0;
+	m_PredictTimeUs = 0;
+	m_VelocityX = m_VelocityY = 0;
+	m_PredictOffsetX = m_PredictOffsetY = 0;
+	SetAccelerationCurve(s_DefaultAccelCurve, ARRAY_SIZE(s_DefaultAccelCurve));
+	CurrentMouseX = CurrentMouseY = 0;
 	CurrentWheel = 0;
 	ButtonState = 0;
+	m_Output.Value = 0;
 
 	m_fPositionChanged = FALSE;
 	m_fContactCountChanged = FALSE;
-	m_ContactCount = 0;
 	m_MaxContactCount = 0;
 	m_ShortTapCount = 0;
 	m_GestureState = GESTURE_STATE_NONE;
 	m_fPositionChanged = FALSE;
 	m_fLastRelease = 0;
 
-	for (int i = 0; i < MAX_TOUCH_POINT; i++)
-	{
-		m_PrevContactArray[i].id = 0;
-		m_PrevContactArray[i].x = 0;
-		m_PrevContactArray[i].y = 0;
-		m_PrevContactArray[i].down = 0;
-		m_PrevContactArray[i].tick = 0;
+	m_SumX = m_SumY = 0;
+	m_fContactMoved = FALSE;
+	m_fContactSetChanged = FALSE;
+	m_LastContactUs = 0;
 
-		m_ContactArray[i].id = 0;
-		m_ContactArray[i].x = 0;
-		m_ContactArray[i].y = 0;
-		m_ContactArray[i].down = 0;
-		m_ContactArray[i].tick = 0;
-	}
+	m_pfnEventCallback = NULL;
+	m_pContext = NULL;
+	m_pfnPostCallback = NULL;
+	m_pPostContext = NULL;
+
+	m_nButtonEvents = 0;
 }
+
+CGesture::~CGesture()
+{
+	m_ButtonEventTimer.Stop();
+	m_ShortTapTimer.StopTimer();
+}
+
 /*
-	Called back when the timer gets expired.
+	Schedule a synthesized button event delay ms from now. Events never overtake the ones
+	scheduled before them. Events which are due now are sent right away, the rest by the timer.
 */
-void CGesture::OnTimeout(void *pContext)
+void CGesture::ScheduleButton(INT8 button, BOOL down, UINT32 delay)
 {
-	CGesture *This = (CGesture *)pContext;
-	Trace(TRACE_LEVEL_ERROR, "OnTimeout\n");
+	ULONGLONG dueTick = m_ButtonEventTimer.GetTick() + delay;
+
+	if (m_nButtonEvents != 0 && m_ButtonEvents[m_nButtonEvents - 1].DueTick > dueTick)
+	{
+		dueTick = m_ButtonEvents[m_nButtonEvents - 1].DueTick;
+	}
+
+	if (m_nButtonEvents == MAX_BUTTON_EVENTS)
+	{
+		Trace(TRACE_LEVEL_ERROR, "ScheduleButton: Timeline is full.\n");
+	}
+	else
+	{
+		m_ButtonEvents[m_nButtonEvents].DueTick = dueTick;
+		m_ButtonEvents[m_nButtonEvents].Button = button;
+		m_ButtonEvents[m_nButtonEvents].Down = down;
+		m_nButtonEvents++;
+	}
 
-	This->UpdateButtonState();
+	RunButtonEvents();
 }
 
-void CGesture::UpdateButtonState()
+/*
+	Send the button events which are due and arm the timer for the next one.
+*/
+void CGesture::RunButtonEvents()
 {
-	if (m_MaxContactCount == 1)
+	ULONGLONG currentTick = m_ButtonEventTimer.GetTick();
+
+	while (m_nButtonEvents != 0 && m_ButtonEvents[0].DueTick <= currentTick)
 	{
-		if (m_ShortTapCount == 1)
+		BUTTON_EVENT event = m_ButtonEvents[0];
+
+		m_nButtonEvents--;
+		MoveMemory(&m_ButtonEvents[0], &m_ButtonEvents[1], m_nButtonEvents * sizeof(BUTTON_EVENT));
+
+		if (event.Button == BUTTON_LEFT)
 		{
-			m_GestureState = GESTURE_STATE_ONE_FINGER_MOVE;
+			UpdateLButtonPress(event.Down);
 		}
-		if (m_ShortTapCount == 2)
+		else
 		{
-			m_GestureState = GESTURE_STATE_ONE_FINGER_SINGLE_TAP;
+			UpdateRButtonPress(event.Down);
+		}
+	}
 
-			UpdateLButtonPress(TRUE);
-			Sleep(50);
-			UpdateLButtonPress(FALSE);
+	if (m_nButtonEvents != 0)
+	{
+		m_ButtonEventTimer.Start((UINT32)(m_ButtonEvents[0].DueTick - currentTick));
+	}
+}
 
-			m_GestureState = GESTURE_STATE_NONE;
-		}
-		if (m_ShortTapCount == 3)
-		{
-			m_GestureState = GESTURE_STATE_ONE_FINGER_DOUBLE_TAP_HOLD;
+void CGesture::OnButtonEventTimer(void *pContext)
+{
+	CGesture *This = (CGesture *)pContext;
 
-			UpdateLButtonPress(TRUE);
-		}
-		if (m_ShortTapCount == 4)
-		{
-			m_GestureState = GESTURE_STATE_ONE_FINGER_DOUBLE_TAP;
+	(*This->m_pfnPostCallback)(This->m_pPostContext, GESTURE_WORK_BUTTON_EVENTS);
+}
 
-			UpdateLButtonPress(TRUE);
-			Sleep(50);
-			UpdateLButtonPress(FALSE);
-			Sleep(50);
-			UpdateLButtonPress(TRUE);
-			Sleep(50);
-			UpdateLButtonPress(FALSE);
+/*
+	Called back on the timer thread when the timer gets expired.
+	The tap is evaluated later on the gesture thread, see RunPostedWork().
+*/
+void CGesture::OnTimeout(void *pContext)
+{
+	CGesture *This = (CGesture *)pContext;
+	Trace(TRACE_LEVEL_ERROR, "OnTimeout\n");
 
-			m_GestureState = GESTURE_STATE_NONE;
-		}
+	(*This->m_pfnPostCallback)(This->m_pPostContext, GESTURE_WORK_SHORT_TAP_TIMEOUT);
+}
 
+/*
+	Run the work which the timers posted. Called on the gesture thread, so that the timeouts
+	are serialized with the touch frames.
+*/
+void CGesture::RunPostedWork(LONG work)
+{
+	// A timeout may have been posted just before the timer was stopped or restarted.
+	if (work & GESTURE_WORK_SHORT_TAP_TIMEOUT)
+	{
+		RunExpiredShortTap();
 	}
-	if (m_MaxContactCount == 2)
+	if (work & GESTURE_WORK_BUTTON_EVENTS)
 	{
-		if (m_ShortTapCount == 1)
-		{
-			m_GestureState = GESTURE_STATE_TWO_FINGER_MOVE;
-		}
-		if (m_ShortTapCount == 2)
-		{
-			m_GestureState = GESTURE_STATE_TWO_FINGER_SINGLE_TAP;
+		RunButtonEvents();
+	}
+}
+
+/*
+	Evaluate the ShortTap duration if its timer ran out. The timeout work is posted, so a frame
+	can come in between. That frame runs this first, otherwise restarting the timer would lose
+	the taps of the duration which already ended.
+*/
+void CGesture::RunExpiredShortTap()
+{
+	if (m_ShortTapTimer.IsExpired())
+	{
+		m_ShortTapTimer.StopTimer();	// Evaluated once per duration.
+		UpdateButtonState();
+	}
+}
 
-			UpdateRButtonPress(TRUE);
-			Sleep(50);
-			UpdateRButtonPress(FALSE);
+/*
+	Classify the taps counted during the ShortTap duration once the timer expired.
+*/
+void CGesture::UpdateButtonState()
+{
+	if ((m_MaxContactCount == 1 || m_MaxContactCount == 2) && m_ShortTapCount >= 1 && m_ShortTapCount <= 4)
+	{
+		GESTURE_EVENT_TYPE firstEvent = (m_MaxContactCount == 1) ? GESTURE_EVENT_ONE_FINGER_HOLD : GESTURE_EVENT_TWO_FINGER_HOLD;
 
-			m_GestureState = GESTURE_STATE_NONE;
-		}
-		if (m_ShortTapCount == 3)
-		{
-			m_GestureState = GESTURE_STATE_TWO_FINGER_DOUBLE_TAP;
-
-			UpdateRButtonPress(TRUE);
-			Sleep(50);
-			UpdateRButtonPress(FALSE);
-			Sleep(50);
-			UpdateRButtonPress(TRUE);
-			m_MaxContactCount = 0;	// Clear MaxContactCount because it's not cleared 
-			// when the finger is released in order for the OnTimeout() to use.
-		}
-		if (m_ShortTapCount == 4)
-		{
-			m_GestureState = GESTURE_STATE_TWO_FINGER_DOUBLE_TAP;
-
-			UpdateLButtonPress(TRUE);
-			Sleep(50);
-			UpdateLButtonPress(FALSE);
-			Sleep(50);
-			UpdateLButtonPress(TRUE);
-			Sleep(50);
-			UpdateLButtonPress(FALSE);
-		}
+		DispatchGestureEvent((GESTURE_EVENT_TYPE)(firstEvent + m_ShortTapCount - 1));
 	}
 
 	m_ShortTapCount = 0;
 }
 
+/*
+	Classify the taps counted so far without waiting for the ShortTap timeout.
+	Called when the taps can't become a double tap any more.
+*/
+void CGesture::CommitTap()
+{
+	Trace(TRACE_LEVEL_INFORMATION, "Tap committed at count %d.\n", m_ShortTapCount);
+
+	m_ShortTapTimer.StopTimer();
+	UpdateButtonState();
+}
+
+/*
+	Start a new ShortTap duration with firstContact as its first tap.
+*/
+void CGesture::RestartShortTap(const CTouchPoint &firstContact)
+{
+	m_FirstContact = firstContact;
+	m_ShortTapTimer.StartTimer(cTickShortTap, CGesture::OnTimeout, this);
+}
+
+void CGesture::DispatchGestureEvent(GESTURE_EVENT_TYPE event)
+{
+	const GESTURE_TRANSITION *pTransition = &s_GestureTransitions[m_GestureState][event];
+
+	m_GestureState = pTransition->NextState;
+	RunGestureAction(pTransition->Action);
+}
+
+/*
+	Synthesize the clicks of the tap gesture. The press and release events are put on the
+	button timeline CLICK_INTERVAL_MS apart, so nothing sleeps here.
+*/
+void CGesture::RunGestureAction(GESTURE_ACTION_TYPE action)
+{
+	switch (action)
+	{
+	case GESTURE_ACTION_LEFT_CLICK:
+		ScheduleButton(BUTTON_LEFT, TRUE, 0);
+		ScheduleButton(BUTTON_LEFT, FALSE, CLICK_INTERVAL_MS);
+		break;
+
+	case GESTURE_ACTION_LEFT_DOUBLE_CLICK:
+		ScheduleButton(BUTTON_LEFT, TRUE, 0);
+		ScheduleButton(BUTTON_LEFT, FALSE, CLICK_INTERVAL_MS);
+		ScheduleButton(BUTTON_LEFT, TRUE, 2 * CLICK_INTERVAL_MS);
+		ScheduleButton(BUTTON_LEFT, FALSE, 3 * CLICK_INTERVAL_MS);
+		break;
+
+	case GESTURE_ACTION_LEFT_PRESS:
+		ScheduleButton(BUTTON_LEFT, TRUE, 0);
+		break;
+
+	case GESTURE_ACTION_LEFT_RELEASE:
+		// This is the case that the double tap was on hold when the ShortTap timer is expired.
+		Trace(TRACE_LEVEL_INFORMATION, "End of One finger double tap.\n");
+		ScheduleButton(BUTTON_LEFT, FALSE, 0);	// Goes out after the press which is still on the timeline.
+		m_MaxContactCount = 0;
+		break;
+
+	case GESTURE_ACTION_RIGHT_CLICK:
+		ScheduleButton(BUTTON_RIGHT, TRUE, 0);
+		ScheduleButton(BUTTON_RIGHT, FALSE, CLICK_INTERVAL_MS);
+		break;
+
+	case GESTURE_ACTION_RIGHT_CLICK_PRESS:
+		ScheduleButton(BUTTON_RIGHT, TRUE, 0);
+		ScheduleButton(BUTTON_RIGHT, FALSE, CLICK_INTERVAL_MS);
+		ScheduleButton(BUTTON_RIGHT, TRUE, 2 * CLICK_INTERVAL_MS);
+		m_MaxContactCount = 0;	// Clear MaxContactCount because it's not cleared 
+		// when the finger is released in order for the OnTimeout() to use.
+		break;
+
+	case GESTURE_ACTION_RIGHT_RELEASE:
+		ScheduleButton(BUTTON_RIGHT, FALSE, 0);	// Goes out after the clicks which are still on the timeline.
+		break;
+
+	case GESTURE_ACTION_TOGGLE:
+		PostGestureEvent();
+		m_MaxContactCount = 0;
+		break;
+
+	default:
+		break;
+	}
+}
+
+
 BOOL CGesture::IsInShortTapRange(CTouchPoint firstTap, CTouchPoint currentTap)
 {
 	if (m_ShortTapCount == 2)
@@ -308,42 +455,121 @@ BOOL CGesture::IsInShortTapRange(CTouchPoint firstTap, CTouchPoint currentTap)
 	return TRUE;
 }
 
-void CGesture::InjectTouchPoint(_In_ HID_TOUCH_REPORT *pTouchReport)
+/*
+	TRUE if the current tap happened within cTickShortTap of the first one. This is judged on
+	the device time, so the delivery delay of the reports doesn't count.
+*/
+BOOL CGesture::IsInShortTapDuration(CTouchPoint firstTap, CTouchPoint currentTap)
+{
+	if (currentTap.tick - firstTap.tick >= (ULONGLONG)cTickShortTap * 1000)
+	{
+		Trace(TRACE_LEVEL_ERROR, "Out-of-duration at count %d.\n", m_ShortTapCount);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+	Process all the contacts of one frame, then run the gesture state machine once.
+	The 1st finger, slot 0, drives tap counting and the centroid of all the fingers drives move
+	and scroll.
+*/
+void CGesture::InjectTouchFrame(_In_ const TOUCH_FRAME *pFrame)
+{
+	BOOL fPrimary = FALSE;
+	BOOL fPrimaryChanged = FALSE;
+
+	// A timeout which is due but not run yet came before this frame.
+	RunExpiredShortTap();
+
+	m_fContactMoved = FALSE;
+	m_fContactSetChanged = FALSE;
+
+	for (UINT32 i = 0; i < pFrame->nContacts; i++)
+	{
+		int slot;
+		BOOL fChanged = UpdateContact(&pFrame->Contacts[i], pFrame->TimeUs, &slot);
+
+		if (slot == 0)
+		{
+			fPrimary = TRUE;
+			fPrimaryChanged = fChanged;
+		}
+	}
+
+	m_fContactCountChanged = fPrimaryChanged;
+
+	CTouchPoint primary = m_ContactArray.GetPoint(0);
+
+	UpdateGesture(fPrimary ? &primary : NULL);
+}
+
+/*
+	Update contact status & update also the ShortTap Timer.
+	Returns TRUE if the contact went down or up, and its slot in *pSlot. The slot is
+	CONTACT_NO_SLOT if the report was dropped.
+*/
+BOOL CGesture::UpdateContact(_In_ const HID_TOUCH_REPORT *pTouchReport, ULONGLONG timeUs, _Out_ int *pSlot)
 {
 	CTouchPoint currentContact;
+	BOOL fChanged = FALSE;
+	int slot;
 
 	currentContact.id = pTouchReport->ContactId;		// ID of current finger.
 	currentContact.x = pTouchReport->wXData;
 	currentContact.y = pTouchReport->wYData;
 	currentContact.down = pTouchReport->bStatus;
-	currentContact.tick = GetTickCount64();
+	currentContact.tick = timeUs;
 
-	//char cDown = (currentContact.down == 1) ? 'D' : 'U';
-	//Trace(TRACE_LEVEL_FATAL, "%ld:%c:[%d](%d,%d)\n", GetTickCount(), cDown, currentContact.id, currentContact.x, currentContact.y);
+	// A finger takes a free slot when it goes down, and gives it back when it's up.
+	if (currentContact.down == TRUE)
+	{
+		slot = m_ContactIds.Insert(currentContact.id);
+	}
+	else
+	{
+		slot = m_ContactIds.Lookup(currentContact.id);
+	}
 
-// Update contact status & update also the ShortTap Timer.
-	// Back-up previous ContactArray to be able to compare with the new array.
-	m_PrevContactArray = m_ContactArray;
+	*pSlot = slot;
+	if (slot == CONTACT_NO_SLOT)
+	{	// More fingers than slots, or the release of a finger which wasn't down.
+		Trace(TRACE_LEVEL_WARNING, "No slot for contact %d.\n", currentContact.id);
+		return FALSE;
+	}
 
-	// Get position and down status of the current finger.
-	m_ContactArray[currentContact.id] = currentContact;
+	// Keep the sums of the centroid up to date with this contact only.
+	if (m_ContactArray.IsDown(slot) == TRUE)
+	{
+		m_SumX -= m_ContactArray.X[slot];
+		m_SumY -= m_ContactArray.Y[slot];
+	}
+	if (currentContact.down == TRUE)
+	{
+		m_SumX += currentContact.x;
+		m_SumY += currentContact.y;
+	}
+	m_fContactMoved = TRUE;
+	m_LastContactUs = timeUs;
 
-	m_fContactCountChanged = FALSE;	// Initialize for this iteration.
+	// Get position and down status of the current finger.
+	m_ContactArray.SetPoint(slot, currentContact);
 
 	if (currentContact.down == TRUE)
 	{	// Down event
-		if (m_PrevContactArray[currentContact.id].down == FALSE)
+		if (m_ContactArray.IsDown(slot) == FALSE)
 		{  // The finger was previously UP.
-			m_ContactCount++;
-			Trace(TRACE_LEVEL_ERROR, "ContactCount=%d\n", m_ContactCount);
+			m_ContactArray.SetDown(slot, TRUE);
+			int contactCount = m_ContactArray.GetCount();
+			Trace(TRACE_LEVEL_ERROR, "ContactCount=%d\n", contactCount);
 
-			m_fContactCountChanged = TRUE;
-			if (m_ContactCount == 1 )
+			fChanged = TRUE;
+			if (contactCount == 1 )
 			{
 				if (m_ShortTapTimer.IsStopped() == TRUE)
 				{  // It's first contact after ShortTapTimer is stopped.
-					m_FirstContact = m_ContactArray[currentContact.id];
-					m_ShortTapTimer.StartTimer(cTickShortTap, CGesture::OnTimeout, this);
+					RestartShortTap(currentContact);
 				}
 				else
 				{
@@ -351,80 +577,73 @@ void CGesture::InjectTouchPoint(_In_ HID_TOUCH_REPORT *pTouchReport)
 				}
 			}
 
-			if (m_MaxContactCount < m_ContactCount)
+			if (m_MaxContactCount < contactCount)
 			{
-				m_MaxContactCount = m_ContactCount;
+				m_MaxContactCount = contactCount;
 			}
 		}
 	}
 	else
 	{	// Up event
-		if (m_PrevContactArray[currentContact.id].down == TRUE)
+		if (m_ContactArray.IsDown(slot) == TRUE)
 		{  // The finger was previously DOWN.
-			m_ContactCount--;
-			Trace(TRACE_LEVEL_ERROR, "ContactCount=%d\n", m_ContactCount);
-			m_fContactCountChanged = TRUE;
-			if (m_ContactCount == 0)
+			m_ContactArray.SetDown(slot, FALSE);
+			m_ContactIds.Remove(currentContact.id);
+			Trace(TRACE_LEVEL_ERROR, "ContactCount=%d\n", m_ContactArray.GetCount());
+			fChanged = TRUE;
+			if (m_ContactArray.DownMask == 0)
 			{
 				m_fLastRelease = TRUE;
 			}
 		}
 	}
 
-// Deal with One finger operation.
-	if (currentContact.id == 0 && m_MaxContactCount == 1)
-	{	
-		if (m_ShortTapTimer.IsStopped() == FALSE)
-		{	// ShortTap Timer is NOT stopped yet.
-			if (FALSE == IsInShortTapRange(m_FirstContact, currentContact))
-			{	// The current tap is out of the ShortTap range.
-				Trace(TRACE_LEVEL_ERROR, "Stopped by move.\n");
-				m_ShortTapTimer.StopTimer();	// No harm to stop timer multiple times.
-			}
+	if (fChanged)
+	{	// The centroid jumps, the move goes on from its new position.
+		m_fContactSetChanged = TRUE;
+	}
 
-			// Count all the Tapping during ShortTap duration.
-			if (m_fContactCountChanged == TRUE)
-			{
-				m_ShortTapCount++;
-				Trace(TRACE_LEVEL_ERROR, "m_ShortTapCount=%d\n", m_ShortTapCount);
-			}
-		}
-		else
-		{	// ShortTap Timer is already stopped.	
-			Trace(TRACE_LEVEL_INFORMATION, "Already stopped by timeout.\n");
-			if (m_fLastRelease==TRUE)
-			{
-				if (m_GestureState == GESTURE_STATE_ONE_FINGER_DOUBLE_TAP_HOLD)
-				{  // This is the case that the double tap was on hold when the ShortTap timer is expired.
-					Trace(TRACE_LEVEL_INFORMATION, "End of One finger double tap.\n");
-					Sleep(300);	// Give some delay just in case OnTimeout() call-back still emulates the LButton events.
-					// In order to remove this delay, queuing mechanism is required to serialize the LButton events
-					// from both Gesture context and OnTimeout() context.
-					UpdateLButtonPress(FALSE);
-					m_GestureState = GESTURE_STATE_NONE;
-					m_MaxContactCount = 0;	// Clear MaxContactCount because it's not cleared 
-				}
-				if (m_GestureState == GESTURE_STATE_ONE_FINGER_MOVE)
-				{
-					m_GestureState = GESTURE_STATE_NONE;
-				}
-			}
-		}
+	return fChanged;
+}
+
+/*
+	Run the gesture state machine after the contacts are updated.
+	pPrimary is the 1st finger if it was updated, otherwise NULL.
+	m_fContactCountChanged tells whether the 1st finger went down or up.
+	Move and scroll follow the centroid of the contacts, whichever of them was updated.
+*/
+void CGesture::UpdateGesture(_In_opt_ const CTouchPoint *pPrimary)
+{
+	CTouchPoint currentContact;
+	BOOL fPrimary = (pPrimary != NULL) ? TRUE : FALSE;
+
+	if (fPrimary)
+	{
+		currentContact = *pPrimary;
 	}
 
-	// Deal with Two finger operation. Focus only on the 1st finger.
-	if (currentContact.id == 0 && m_MaxContactCount == 2)
+// Deal with One and Two finger operation. Focus only on the 1st finger.
+	if (fPrimary && (m_MaxContactCount == 1 || m_MaxContactCount == 2))
 	{
 		if (m_ShortTapTimer.IsStopped() == FALSE)
 		{	// ShortTap Timer is NOT stopped yet.
 			if (FALSE == IsInShortTapRange(m_FirstContact, currentContact))
 			{	// The current tap is out of the ShortTap range.
 				Trace(TRACE_LEVEL_ERROR, "Stopped by 1st finger move.\n");
-				m_ShortTapTimer.StopTimer();	// No harm to stop timer multiple times.
+				if (cTapPolicy != TAP_POLICY_WAIT_TIMEOUT && m_ShortTapCount == 2)
+				{	// A tap, then a touch too far away to be its double tap. The tap is classified
+					// as if it had timed out just before this touch, which starts a duration of its own.
+					CommitTap();
+					RestartShortTap(currentContact);
+				}
+				else
+				{
+					m_ShortTapTimer.StopTimer();	// No harm to stop timer multiple times.
+				}
 			}
 
 			// Count all the Tapping during ShortTap duration.
-			if (m_fContactCountChanged == TRUE)
+			if (m_fContactCountChanged == TRUE && IsInShortTapDuration(m_FirstContact, currentContact))
 			{
 				m_ShortTapCount++;
 				Trace(TRACE_LEVEL_ERROR, "m_ShortTapCount=%d\n", m_ShortTapCount);
@@ -434,55 +653,42 @@ void CGesture::InjectTouchPoint(_In_ HID_TOUCH_REPORT *pTouchReport)
 		{	// ShortTap Timer is already stopped.	
 			Trace(TRACE_LEVEL_INFORMATION, "Already stopped by timeout.\n");
 			if (m_fLastRelease == TRUE)
-			{
-				if (m_GestureState == GESTURE_STATE_TWO_FINGER_DOUBLE_TAP)
-				{  // This is the case that the double tap was on hold when the ShortTap timer is expired.
-					Sleep(300);	// Give some delay just in case OnTimeout() call-back still emulates the RButton events.
-					// In order to remove this delay, queuing mechanism is required to serialize the RButton events
-					// from both Gesture context and OnTimeout() context.
-					UpdateRButtonPress(FALSE);
-					m_GestureState = GESTURE_STATE_NONE;
-				}
-				if (m_GestureState == GESTURE_STATE_TWO_FINGER_MOVE)
-				{
-					m_GestureState = GESTURE_STATE_NONE;
-				}
+			{	// Ends the gesture which was on hold or moving.
+				DispatchGestureEvent((m_MaxContactCount == 1) ? GESTURE_EVENT_ONE_FINGER_RELEASE : GESTURE_EVENT_TWO_FINGER_RELEASE);
 			}
 		}
 	}
 
-// Report One finger move event.
-	if (currentContact.id == 0 && m_MaxContactCount==1 )
-	{
-		if (m_fContactCountChanged)
-		{
-			UpdateCursor(currentContact.x, currentContact.y, TRUE);	// New position is registered.
-		}
-		else
-		{
-			UpdateCursor(currentContact.x, currentContact.y, FALSE); // Move event can be sent even within ShortTap duration.
-		}
+// A tap is complete when its last finger goes up, whichever finger that is.
+	if (cTapPolicy == TAP_POLICY_NO_DOUBLE_TAP && m_fLastRelease == TRUE && m_ShortTapCount == 2 &&
+		m_ShortTapTimer.IsStopped() == FALSE && (m_MaxContactCount == 1 || m_MaxContactCount == 2))
+	{	// Nothing more to wait for.
+		CommitTap();
 	}
 
-// Deal with Two finger move event. Focus only on the 1st finger regarding move and down/up.
-	if (currentContact.id == 0 && m_MaxContactCount == 2)
+// Report move and scroll events from the centroid of all the fingers on the pad.
+	int contactCount = m_ContactArray.GetCount();
+
+	if (m_fContactMoved && contactCount != 0 && (m_MaxContactCount == 1 || m_MaxContactCount == 2))
 	{
-		if (m_fContactCountChanged)
+		INT32 centroidX = m_SumX / contactCount;
+		INT32 centroidY = m_SumY / contactCount;
+
+		// A new stroke only registers the new position. Events can be sent even within ShortTap duration.
+		if (m_MaxContactCount == 1)
 		{
-			UpdateScroll(currentContact.x, currentContact.y, TRUE);	// New position is registered.
+			UpdateCursor(centroidX, centroidY, m_LastContactUs, m_fContactSetChanged);
 		}
 		else
 		{
-			UpdateScroll(currentContact.x, currentContact.y, FALSE); // Scroll event can be sent even within ShortTap duration.
+			UpdateScroll(centroidX, centroidY, m_fContactSetChanged);
 		}
 	}
 
 	if (m_MaxContactCount == 4 && m_fLastRelease == TRUE)
 	{
 		Trace(TRACE_LEVEL_INFORMATION, "TogglePointingMode.\n");
-		m_GestureState = GESTURE_STATE_TOGGLE;
-		PostGestureEvent();
-		m_MaxContactCount = 0;
+		DispatchGestureEvent(GESTURE_EVENT_FOUR_FINGER_RELEASE);
 	}
 
 	
@@ -510,84 +716,186 @@ void CGesture::InjectTouchPoint(_In_ HID_TOUCH_REPORT *pTouchReport)
 void CGesture::ClearContactStatus()
 {
 	m_fContactCountChanged = FALSE;
-	m_ContactCount = 0;
 	m_fLastRelease = FALSE;
 
-	for (int i = 0; i < MAX_TOUCH_POINT; i++)
+	// The points of the released slots are never read, so only the masks and the slot map are cleared.
+	m_ContactArray.DownMask = 0;
+	m_ContactIds.Clear();
+	m_SumX = m_SumY = 0;
+}
+
+/*
+	Compile the acceleration curve into the gain LUT. The speeds of the points must be
+	increasing. Speeds below the first point get its gain, and above the last point the last gain.
+	Returns FALSE and keeps the current curve if the points are not valid.
+*/
+BOOL CGesture::SetAccelerationCurve(_In_reads_(nPoints) const ACCEL_POINT *pPoints, UINT32 nPoints)
+{
+	if (nPoints == 0 || nPoints > MAX_ACCEL_POINTS)
 	{
-		m_PrevContactArray[i].id = 0;
-		m_PrevContactArray[i].x = 0;
-		m_PrevContactArray[i].y = 0;
-		m_PrevContactArray[i].down = 0;
-		m_PrevContactArray[i].tick = 0;
+		return FALSE;
+	}
 
-		m_ContactArray[i].id = 0;
-		m_ContactArray[i].x = 0;
-		m_ContactArray[i].y = 0;
-		m_ContactArray[i].down = 0;
-		m_ContactArray[i].tick = 0;
+	for (UINT32 i = 0; i < nPoints; i++)
+	{
+		if (pPoints[i].Gain > MAXUINT16 || (i > 0 && pPoints[i].Speed <= pPoints[i - 1].Speed))
+		{
+			Trace(TRACE_LEVEL_ERROR, "SetAccelerationCurve - Invalid point %d.\n", i);
+			return FALSE;
+		}
 	}
+
+	UINT32 point = 0;
+	for (UINT32 i = 0; i < ACCEL_LUT_SIZE; i++)
+	{
+		// Gain at the middle of the speeds of the entry.
+		UINT32 speed = (i << ACCEL_LUT_SHIFT) + (1 << (ACCEL_LUT_SHIFT - 1));
+
+		while (point < nPoints && pPoints[point].Speed <= speed)
+		{
+			point++;
+		}
+
+		if (point == 0)
+		{
+			m_AccelLut[i] = (UINT16)pPoints[0].Gain;
+		}
+		else if (point == nPoints)
+		{
+			m_AccelLut[i] = (UINT16)pPoints[nPoints - 1].Gain;
+		}
+		else
+		{
+			const ACCEL_POINT &lo = pPoints[point - 1];
+			const ACCEL_POINT &hi = pPoints[point];
+			INT32 gain = (INT32)lo.Gain + ((INT32)hi.Gain - (INT32)lo.Gain) * (INT32)(speed - lo.Speed) / (INT32)(hi.Speed - lo.Speed);
+
+			m_AccelLut[i] = (UINT16)gain;
+		}
+	}
+
+	return TRUE;
 }
 
-void CGesture::UpdateCursor(int x, int y, BOOL newstroke)
+/*
+	Move (x, y) to where the contact is expected cPredictionUs later, to make up for the delay
+	of the reports on their way through the pipeline. The cursor follows the predicted positions,
+	so when the contact slows down or stops, the prediction falls back onto it by itself.
+*/
+void CGesture::PredictPosition(_Inout_ int *pX, _Inout_ int *pY, ULONGLONG timeUs, BOOL newstroke)
 {
-	if (newstroke == TRUE)
+	ULONGLONG dtUs = timeUs - m_PredictTimeUs;
+	INT32 velocityX = 0;
+	INT32 velocityY = 0;
+
+	if (newstroke == FALSE && dtUs == 0)
+	{	// Same time as the last position, nothing to learn. The cursor must not fall back onto the contact.
+		m_PredictX = *pX;
+		m_PredictY = *pY;
+		*pX += m_PredictOffsetX;
+		*pY += m_PredictOffsetY;
+		return;
+	}
+
+	if (newstroke == FALSE && dtUs <= PREDICTION_RESET_US)
 	{
-		Trace(TRACE_LEVEL_INFORMATION, "UpdateCursor - New stroke.\n");
+		LONGLONG vx = (LONGLONG)(*pX - m_PredictX) * 1000000 / (LONGLONG)dtUs;
+		LONGLONG vy = (LONGLONG)(*pY - m_PredictY) * 1000000 / (LONGLONG)dtUs;
 
-		PreviousTouchpadX = x;
-		PreviousTouchpadY = y;
-		return;
+		if (vx > MAX_PREDICTION_VELOCITY) vx = MAX_PREDICTION_VELOCITY;
+		if (vx < -MAX_PREDICTION_VELOCITY) vx = -MAX_PREDICTION_VELOCITY;
+		if (vy > MAX_PREDICTION_VELOCITY) vy = MAX_PREDICTION_VELOCITY;
+		if (vy < -MAX_PREDICTION_VELOCITY) vy = -MAX_PREDICTION_VELOCITY;
+
+		velocityX = (INT32)vx;
+		velocityY = (INT32)vy;
 	}
 
-	INT32 Delta = abs(x - PreviousTouchpadX) + abs(y - PreviousTouchpadY);
-	INT32 scale;
+	m_PredictX = *pX;
+	m_PredictY = *pY;
+	m_PredictTimeUs = timeUs;
 
-	if (Delta > 1000)
-	{
-		scale = 8;
-		Trace(TRACE_LEVEL_VERBOSE, "FASTEST ");
+	if (velocityX == 0 && velocityY == 0)
+	{	// New stroke, or at rest.
+		m_VelocityX = m_VelocityY = 0;
+		m_PredictOffsetX = m_PredictOffsetY = 0;
+		return;
 	}
-	else if (Delta > 100)
+
+	UINT32 horizonUs = (cPredictionUs > MAX_PREDICTION_US) ? MAX_PREDICTION_US : cPredictionUs;
+	// The first velocity after a rest has nothing to change from. A contact which lands moving
+	// would look like one which speeds up from 0, and the cursor would jump twice as far ahead.
+	BOOL fFirst = (m_VelocityX == 0 && m_VelocityY == 0) ? TRUE : FALSE;
+
+	m_PredictOffsetX = PredictAxis(velocityX, fFirst ? velocityX : m_VelocityX, dtUs, horizonUs);
+	m_PredictOffsetY = PredictAxis(velocityY, fFirst ? velocityY : m_VelocityY, dtUs, horizonUs);
+	*pX += m_PredictOffsetX;
+	*pY += m_PredictOffsetY;
+
+	m_VelocityX = velocityX;
+	m_VelocityY = velocityY;
+}
+
+void CGesture::UpdateCursor(int x, int y, ULONGLONG timeUs, BOOL newstroke)
+{
+	if (cPredictionUs != 0)
 	{
-		scale = 4;
-		Trace(TRACE_LEVEL_VERBOSE, "FAST ");
+		PredictPosition(&x, &y, timeUs, newstroke);
 	}
-	else
+
+	if (newstroke == TRUE)
 	{
-		scale = 1;
+		Trace(TRACE_LEVEL_INFORMATION, "UpdateCursor - New stroke.\n");
+
+		PreviousTouchpadX = x;
+		PreviousTouchpadY = y;
+		m_RemainderX = m_RemainderY = 0;
+		return;
 	}
 
+	INT32 Delta = abs(x - PreviousTouchpadX) + abs(y - PreviousTouchpadY);
+
 	if (Delta == 0)
 	{	// No move, no need to report.
 		Trace(TRACE_LEVEL_VERBOSE, "No move.\n");
 		return;
 	}
 
+	UINT32 index = (UINT32)Delta >> ACCEL_LUT_SHIFT;
+	INT32 gain = m_AccelLut[(index < ACCEL_LUT_SIZE) ? index : ACCEL_LUT_SIZE - 1];
+	INT32 moveX = ApplyAccelGain(x - PreviousTouchpadX, gain, &m_RemainderX);
+	INT32 moveY = ApplyAccelGain(y - PreviousTouchpadY, gain, &m_RemainderY);
+
+	PreviousTouchpadX = x;
+	PreviousTouchpadY = y;
+
+	if (moveX == 0 && moveY == 0)
+	{	// Less than an output unit so far. It's carried in the remainder.
+		Trace(TRACE_LEVEL_VERBOSE, "Sub-pixel move.\n");
+		return;
+	}
+
 #if ABSOLUTE_ASIX
-	CurrentMouseX += scale*(x - PreviousTouchpadX);
+	CurrentMouseX += moveX;
 	if (CurrentMouseX < 0) CurrentMouseX = 0;
 	if (CurrentMouseX >= MAX_MOUSE_X) CurrentMouseX = MAX_MOUSE_X - 1;
 #else
-	CurrentMouseX = scale*(x - PreviousTouchpadX);
-	if (CurrentMouseX < -1024) CurrentMouseX = -1024;
-	if (CurrentMouseX > 1023) CurrentMouseX = 1023;
+	CurrentMouseX = moveX;	// The output queue carries what doesn't fit in one report.
+	if (CurrentMouseX < -MAX_MOUSE_X) CurrentMouseX = -MAX_MOUSE_X;
+	if (CurrentMouseX > MAX_MOUSE_X - 1) CurrentMouseX = MAX_MOUSE_X - 1;
 #endif
 
 #if ABSOLUTE_ASIX
-	CurrentMouseY += scale*(y - PreviousTouchpadY);
+	CurrentMouseY += moveY;
 	if (CurrentMouseY < 0) CurrentMouseY = 0;
 	if (CurrentMouseY >= MAX_MOUSE_Y) CurrentMouseY = MAX_MOUSE_Y - 1;
 #else
-	CurrentMouseY = scale*(y - PreviousTouchpadY);
-	if (CurrentMouseY < -1024) CurrentMouseY = -1024;
-	if (CurrentMouseY > 1023) CurrentMouseY = 1023;
+	CurrentMouseY = moveY;	// The output queue carries what doesn't fit in one report.
+	if (CurrentMouseY < -MAX_MOUSE_Y) CurrentMouseY = -MAX_MOUSE_Y;
+	if (CurrentMouseY > MAX_MOUSE_Y - 1) CurrentMouseY = MAX_MOUSE_Y - 1;
 #endif
 
-	Trace(TRACE_LEVEL_VERBOSE, "(%d, %d)\n", CurrentMouseX, CurrentMouseY );
-
-	PreviousTouchpadX = x;
-	PreviousTouchpadY = y;
+	Trace(TRACE_LEVEL_VERBOSE, "(%d, %d) gain %d\n", CurrentMouseX, CurrentMouseY, gain);
 
 	PostGestureEvent();
 }
@@ -655,11 +963,39 @@ void CGesture::UpdateScroll(int x, int y, BOOL newstroke)
 	PostGestureEvent();
 }
 
+/*
+	Publish the output state and notify. The deltas are reported once, so that a button event
+	doesn't repeat the last move or scroll.
+*/
 void CGesture::PostGestureEvent()
 {
+	GESTURE_OUTPUT output;
+
+	output.u.MouseX = (INT16)CurrentMouseX;
+	output.u.MouseY = (INT16)CurrentMouseY;
+	output.u.Wheel = (INT8)CurrentWheel;
+	output.u.Buttons = ButtonState;
+	output.u.Sequence = m_Output.u.Sequence + 1;
+
+	InterlockedExchange64(&m_Output.Value, output.Value);
+
+#if !ABSOLUTE_ASIX
+	CurrentMouseX = 0;
+	CurrentMouseY = 0;
+#endif
+	CurrentWheel = 0;	// The wheel is relative in both modes.
+
 	(*m_pfnEventCallback)(m_pContext);
 }
 
+/*
+	Read the last published output state. Wait-free and safe on any thread.
+*/
+void CGesture::GetOutput(_Out_ PGESTURE_OUTPUT pOutput)
+{
+	pOutput->Value = InterlockedCompareExchange64(&m_Output.Value, 0, 0);
+}
+
 void CGesture::ClearGestureState()
 {
 	m_GestureState = GESTURE_STATE_NONE;
@@ -674,4 +1010,10 @@ void CGesture::SetEventCallback(void *pContext, PFN_GESTURE_EVENT_CALLBACK pfnCa
 {
 	m_pContext = pContext;
 	m_pfnEventCallback = pfnCallback;
+}
+
+void CGesture::SetPostCallback(void *pContext, PFN_GESTURE_POST_CALLBACK pfnCallback)
+{
+	m_pPostContext = pContext;
+	m_pfnPostCallback = pfnCallback;
 }
\ No newline at end of file
@@ -1,9 +1,33 @@
 #pragma once
 
-#define MAX_TOUCH_POINT	10
+#include "Timer.h"
+#include "Contact.h"
 
 #define NM_TOUCH_CONTACT_TO_TOGGLE 4 // Number of touch contacts to toggle blocking of multi-touch.
 
+#define CLICK_INTERVAL_MS	50	// Interval between the synthesized button press and release events.
+#define MAX_BUTTON_EVENTS	8	// Synthesized button events which can be scheduled at once.
+
+#define BUTTON_LEFT		0x1
+#define BUTTON_RIGHT	0x2
+
+// Pointer acceleration. The gain is looked up by the speed of the move, |dx| + |dy| in device
+// units per report, and applied in fixed point. See CGesture::SetAccelerationCurve().
+#define ACCEL_GAIN_SHIFT	8	// Gains and the sub-pixel remainder have 8 fraction bits, 256 is 1.0x.
+#define ACCEL_LUT_SHIFT		3	// One LUT entry per 8 units of speed.
+#define ACCEL_LUT_SIZE		256	// Speeds from 2048 on use the last entry.
+#define MAX_ACCEL_POINTS	8
+
+// Cursor prediction. See CGesture::PredictPosition().
+#define DEFAULT_PREDICTION_US	0		// Off.
+#define MAX_PREDICTION_US		50000
+#define PREDICTION_RESET_US		100000	// A contact which didn't move for this long is at rest.
+#define MAX_PREDICTION_VELOCITY	(MAX_MOUSE_X * 100)	// Units per second.
+
+// Work which the timers post to the gesture thread. See CGesture::RunPostedWork().
+#define GESTURE_WORK_SHORT_TAP_TIMEOUT	0x1
+#define GESTURE_WORK_BUTTON_EVENTS		0x2
+
 enum GESTURE_STATE_TYPE
 {
 	GESTURE_STATE_NONE = 0,
@@ -22,91 +46,148 @@ enum GESTURE_STATE_TYPE
 	GESTURE_STATE_MAX
 };
 
-class CTouchPoint
+// Inputs of the gesture state machine. The ShortTap timeouts are named after the taps counted
+// in the duration: 1 transition is a finger on hold, 2 a tap, 3 a tap and hold, 4 a double tap.
+enum GESTURE_EVENT_TYPE
 {
-public:
-	int x;
-	int y;
-	int down;
-	ULONGLONG tick;
-	int id;
-public:
-	CTouchPoint & operator=(const CTouchPoint &rhs)
-	{
-		this->x = rhs.x;
-		this->y = rhs.y;
-		this->down = rhs.down;
-		this->tick = rhs.tick;
-		this->id = rhs.id;
-		return *this;
-	}
+	GESTURE_EVENT_ONE_FINGER_HOLD = 0,
+	GESTURE_EVENT_ONE_FINGER_TAP,
+	GESTURE_EVENT_ONE_FINGER_TAP_HOLD,
+	GESTURE_EVENT_ONE_FINGER_DOUBLE_TAP,
+	GESTURE_EVENT_TWO_FINGER_HOLD,
+	GESTURE_EVENT_TWO_FINGER_TAP,
+	GESTURE_EVENT_TWO_FINGER_TAP_HOLD,
+	GESTURE_EVENT_TWO_FINGER_DOUBLE_TAP,
+	GESTURE_EVENT_ONE_FINGER_RELEASE,	/* Last finger up after the timeout */
+	GESTURE_EVENT_TWO_FINGER_RELEASE,
+	GESTURE_EVENT_FOUR_FINGER_RELEASE,
+	GESTURE_EVENT_MAX
 };
 
-// Get 1-dimension distance
-UINT32 GetDistance(int a, int b);
-// Get 2-dimension distance
-ULONG GetDistance(CTouchPoint a, CTouchPoint b);
+enum GESTURE_ACTION_TYPE
+{
+	GESTURE_ACTION_NONE = 0,
+	GESTURE_ACTION_LEFT_CLICK,
+	GESTURE_ACTION_LEFT_DOUBLE_CLICK,
+	GESTURE_ACTION_LEFT_PRESS,
+	GESTURE_ACTION_LEFT_RELEASE,
+	GESTURE_ACTION_RIGHT_CLICK,
+	GESTURE_ACTION_RIGHT_CLICK_PRESS,	/* Click, then press and hold */
+	GESTURE_ACTION_RIGHT_RELEASE,
+	GESTURE_ACTION_TOGGLE,
+	GESTURE_ACTION_MAX
+};
+
+// When a tap is turned into a click.
+enum TAP_POLICY_TYPE
+{
+	TAP_POLICY_WAIT_TIMEOUT = 0,	/* Always at the end of the ShortTap duration */
+	TAP_POLICY_EARLY_COMMIT,		/* As soon as the next touch lands out of the range of the tap */
+	TAP_POLICY_NO_DOUBLE_TAP,		/* On the release of the tap, double taps are never recognized */
+	TAP_POLICY_MAX
+};
+
+#define DEFAULT_TAP_POLICY	TAP_POLICY_WAIT_TIMEOUT
+
+typedef struct _GESTURE_TRANSITION
+{
+	GESTURE_ACTION_TYPE Action;
+	GESTURE_STATE_TYPE NextState;
+} GESTURE_TRANSITION, *PGESTURE_TRANSITION;
+
+// All the contacts which the device reported with the same timestamp.
+typedef struct _TOUCH_FRAME
+{
+	UINT16 Timestamp;
+	ULONGLONG TimeUs;		// Timestamp unwrapped to microseconds by CTouchClock.
+	UINT32 nContacts;
+	HID_TOUCH_REPORT Contacts[MAX_TOUCH_POINT];
+} TOUCH_FRAME, *PTOUCH_FRAME;
+
+// Control point of the acceleration curve. The gain is linear in between the points.
+typedef struct _ACCEL_POINT
+{
+	UINT32 Speed;		// |dx| + |dy| in device units per report.
+	UINT32 Gain;		// Output units per device unit, in 1/256.
+} ACCEL_POINT, *PACCEL_POINT;
+
+// A synthesized button press or release, released to the output when it is due.
+typedef struct _BUTTON_EVENT
+{
+	ULONGLONG DueTick;
+	INT8 Button;		// BUTTON_LEFT or BUTTON_RIGHT
+	BOOL Down;
+} BUTTON_EVENT, *PBUTTON_EVENT;
+
+//
+// Output state of the gesture engine as one 64-bit word. It's published and read with a
+// single interlocked operation, so that a reader never sees the fields of two updates mixed.
+// Relative mode keeps the deltas of the event in MouseX and MouseY, absolute mode the position.
+//
+typedef union DECLSPEC_ALIGN(8) _GESTURE_OUTPUT
+{
+	struct
+	{
+		INT16 MouseX;
+		INT16 MouseY;
+		INT8 Wheel;
+		INT8 Buttons;
+		UINT16 Sequence;	// Incremented on every publish.
+	} u;
+	LONGLONG Value;
+} GESTURE_OUTPUT, *PGESTURE_OUTPUT;
+
+static_assert(sizeof(GESTURE_OUTPUT) == sizeof(LONGLONG), "GESTURE_OUTPUT must fit in one interlocked word.");
 
 typedef void (*PFN_SHORT_TAP_CALLBACK)(void *pContext);
 typedef void(*PFN_GESTURE_EVENT_CALLBACK)(void *pContext);
+typedef void(*PFN_GESTURE_POST_CALLBACK)(void *pContext, LONG work);
 
+//
+// One-shot timer of the ShortTap duration, armed on a timer wheel.
+//
 class CShortTapTimer
 {
 private:
-#if TIMER_EMULATION
-	UINT32 m_Count;
-#else
-	ULONGLONG m_TickCount;
-#endif
+	ULONGLONG m_TickCount;	// Wheel tick when the timer was started.
 	UINT32 m_Threshold;
 	PFN_SHORT_TAP_CALLBACK m_pfnCallback;
 	PVOID m_Context;
 
-	HANDLE	m_StartEvent;	// Notify timer started.
+	CWheelTimer m_WheelTimer;
+
+	static void OnWheelTimer(void *pContext);
 
 public:
-	CShortTapTimer();
+	CShortTapTimer(_In_opt_ CTimerWheel *pWheel = NULL);
 	~CShortTapTimer();
 
 	void StartTimer(UINT32 threshold, PFN_SHORT_TAP_CALLBACK callback, PVOID context);		//	threshold : time duration to expire.
-#if TIMER_EMULATION
-	void IncrementTimer();
-#endif
 	void StopTimer();
 	BOOL IsStopped();
-	static DWORD WINAPI TimerThread(LPVOID lpParam);
-};
-
-class CContactArray
-{
-public:
-	CTouchPoint points[MAX_TOUCH_POINT];
-
-	CContactArray & operator=(const CContactArray &rhs)
-	{
-		for (int i = 0; i < MAX_TOUCH_POINT; i++)
-		{
-			this->points[i] = rhs.points[i];
-		}
-		return *this;
-	}
-
-	CTouchPoint &operator[](const int index)
-	{
-		return points[index];
-	}
-
+	BOOL IsExpired();	// TRUE if the timer ran out, as opposed to being stopped.
 };
 
+//
+// Not thread-safe. All the methods except OnTimeout() run on one thread, the gesture thread.
+// The timers only post GESTURE_WORK_* bits through the post callback, and the gesture thread
+// runs them with RunPostedWork() in between the touch frames.
+//
 class CGesture
 {
 public:
-	CContactArray m_PrevContactArray;
 	CContactArray m_ContactArray;
+	CContactIdMap m_ContactIds;		// Slots of m_ContactArray by device contact ID.
+
+	// Sums of the positions of the contacts which are down. Their centroid moves and scrolls.
+	INT32 m_SumX;
+	INT32 m_SumY;
+	BOOL m_fContactMoved;			// A contact was updated by the current report or frame.
+	BOOL m_fContactSetChanged;		// A contact went down or up in the current report or frame.
+	ULONGLONG m_LastContactUs;		// Time of the last contact update.
 
 	BOOL m_fContactCountChanged;
 	BOOL m_fPositionChanged;
-	int m_ContactCount;
 	int m_MaxContactCount;
 	BOOL m_fLastRelease;
 	int m_ShortTapCount;	// How many taps during ShortTap duration, 0: No tap, 1: Single tap, 2: Double tap.
@@ -119,43 +200,85 @@ public:
 	int cTickShortTap = 300;	// How much tick to consider as short tap. 300ms
 	int cShortMoveTolerance = 100; // Minimum move required to be considered as short move. The short move will be considered as tap unless the move is farther than this.
 	int cShortMoveRange = 1000;
+	TAP_POLICY_TYPE cTapPolicy = DEFAULT_TAP_POLICY;
+	UINT32 cPredictionUs = DEFAULT_PREDICTION_US;	// How far ahead the cursor is extrapolated, up to MAX_PREDICTION_US. 0: No prediction.
 
 	GESTURE_STATE_TYPE m_GestureState;
 
+	// Written by the gesture engine only. Readers on other threads use GetOutput().
 	INT32   CurrentMouseX;
 	INT32   CurrentMouseY;
 	INT32   CurrentWheel;
 	INT8	ButtonState;
 private:
+	GESTURE_OUTPUT	m_Output;		// Last published output state.
+
 	// To maintain mouse point.
 	INT32   PreviousTouchpadX;
 	INT32   PreviousTouchpadY;
 	INT8    PreviousContactState;
 	INT32	LastTouchpadPressure;
+	INT32	m_RemainderX;		// Sub-pixel motion carried to the next report, in 1/256.
+	INT32	m_RemainderY;
+	UINT16	m_AccelLut[ACCEL_LUT_SIZE];	// Gain by speed, in 1/256.
+
+	// Last contact position which the prediction saw, and its velocity in units per second.
+	INT32	m_PredictX;
+	INT32	m_PredictY;
+	ULONGLONG	m_PredictTimeUs;
+	INT32	m_VelocityX;
+	INT32	m_VelocityY;
+	INT32	m_PredictOffsetX;	// Last move added by the prediction.
+	INT32	m_PredictOffsetY;
 	DWORD	LastTouchTick;
 	PFN_GESTURE_EVENT_CALLBACK m_pfnEventCallback;	// Event callback to be called in order to notify.
 	void	*m_pContext;		// Context for event-callback.
+	PFN_GESTURE_POST_CALLBACK m_pfnPostCallback;	// Hands timer work over to the gesture thread.
+	void	*m_pPostContext;	// Context for post-callback.
+
+	// Timeline of synthesized clicks. Events are kept in due order.
+	BUTTON_EVENT	m_ButtonEvents[MAX_BUTTON_EVENTS];
+	UINT32			m_nButtonEvents;
+	CWheelTimer		m_ButtonEventTimer;	// Fires when the first event of the timeline is due.
+
+	void CommitTap();
+	void RestartShortTap(const CTouchPoint &firstContact);
+	void DispatchGestureEvent(GESTURE_EVENT_TYPE event);
+	void RunGestureAction(GESTURE_ACTION_TYPE action);
+
+	void ScheduleButton(INT8 button, BOOL down, UINT32 delay);
+	void RunButtonEvents();
+	static void OnButtonEventTimer(void *pContext);
 
 public:
-	CGesture();
-	virtual ~CGesture()
-	{}
+	// The engine reads the time from pWheel, or runs on the shared system clock wheel if it's NULL.
+	CGesture(_In_opt_ CTimerWheel *pWheel = NULL);
+	virtual ~CGesture();
 
 	BOOL IsInShortTapRange(CTouchPoint firstTap, CTouchPoint currentTap);
+	BOOL IsInShortTapDuration(CTouchPoint firstTap, CTouchPoint currentTap);
 
-	void InjectTouchPoint(_In_ HID_TOUCH_REPORT *pTouchReport);
+	void InjectTouchFrame(_In_ const TOUCH_FRAME *pFrame);
+	BOOL UpdateContact(_In_ const HID_TOUCH_REPORT *pTouchReport, ULONGLONG timeUs, _Out_ int *pSlot);
+	void UpdateGesture(_In_opt_ const CTouchPoint *pPrimary);
 	BOOL IsToggleEvent();
 	void ClearContactStatus();
 
-	void UpdateCursor(int x, int y, BOOL newstroke);
+	BOOL SetAccelerationCurve(_In_reads_(nPoints) const ACCEL_POINT *pPoints, UINT32 nPoints);
+	void PredictPosition(_Inout_ int *pX, _Inout_ int *pY, ULONGLONG timeUs, BOOL newstroke);
+	void UpdateCursor(int x, int y, ULONGLONG timeUs, BOOL newstroke);
 	void UpdateScroll(int x, int y, BOOL newstroke);
 	void UpdateLButtonPress(BOOL down);
 	void UpdateRButtonPress(BOOL down);
 	void UpdateButtonState();
+	void RunExpiredShortTap();
 
 	void SetEventCallback(void *pContext, PFN_GESTURE_EVENT_CALLBACK pfnCallback);
+	void SetPostCallback(void *pContext, PFN_GESTURE_POST_CALLBACK pfnCallback);
+	void RunPostedWork(LONG work);
 
 	static void OnTimeout(void *pContext);
 	void PostGestureEvent();
+	void GetOutput(_Out_ PGESTURE_OUTPUT pOutput);
 	void ClearGestureState();
 };
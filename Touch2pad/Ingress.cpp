@@ -0,0 +1,459 @@
+#include "internal.h"
+#if defined(EVENT_TRACING)
+#include "ingress.tmh"
+#endif
+#include "Ingress.h"
+
+//
+// Implementions of CReorderBuffer.
+//
+CReorderBuffer::CReorderBuffer()
+{
+	LARGE_INTEGER frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	m_HoldTicks = frequency.QuadPart * REORDER_HOLD_US / 1000000;
+
+	m_nEntries = 0;
+	m_fReleased = FALSE;
+	m_LastReleased = 0;
+	m_nLastReleased = 0;
+	m_nLastContacts = 0;
+	m_ScanPeriod = 0;
+
+	ZeroMemory(m_IdTimestamp, sizeof(m_IdTimestamp));
+	ZeroMemory(m_IdReleased, sizeof(m_IdReleased));
+
+	m_nReordered = 0;
+	m_nLate = 0;
+	m_nDropped = 0;
+}
+
+void CReorderBuffer::Insert(_In_ const HID_TOUCH_REPORT *pReport, LONGLONG now)
+{
+	UINT32 pos;
+
+	if (m_fReleased && TimestampDiff(pReport->Timestamp, m_LastReleased) < 0)
+	{	// Older than a report which is already gone to the gesture engine.
+		InterlockedIncrement(&m_nLate);
+		if (pReport->bStatus != 0)
+		{	// A stale position is useless now.
+			InterlockedIncrement(&m_nDropped);
+			return;
+		}
+		if ((m_IdReleased[pReport->ContactId / 32] & (1u << (pReport->ContactId % 32))) &&
+			TimestampDiff(m_IdTimestamp[pReport->ContactId], pReport->Timestamp) > 0)
+		{	// The contact reported again after it. It would lift a finger which landed again.
+			InterlockedIncrement(&m_nDropped);
+			return;
+		}
+		// A lift-off must not be lost, otherwise the contact stays down. Release it next.
+		pos = 0;
+	}
+	else
+	{
+		// Find the place from the tail. Reports with the same timestamp keep their arrival order.
+		pos = m_nEntries;
+		while (pos > 0 && TimestampDiff(m_Entries[pos - 1].Report.Timestamp, pReport->Timestamp) > 0)
+		{
+			pos--;
+		}
+	}
+
+	if (m_nEntries == REORDER_CAPACITY)
+	{	// Release() keeps a free entry, so this is not expected.
+		Trace(TRACE_LEVEL_ERROR, "Reorder buffer is full.\n");
+		InterlockedIncrement(&m_nDropped);
+		return;
+	}
+
+	if (pos != m_nEntries)
+	{
+		InterlockedIncrement(&m_nReordered);
+		MoveMemory(&m_Entries[pos + 1], &m_Entries[pos], (m_nEntries - pos) * sizeof(REORDER_ENTRY));
+	}
+
+	m_Entries[pos].Report = *pReport;
+	m_Entries[pos].ArrivalTime = now;
+	m_nEntries++;
+}
+
+LONGLONG CReorderBuffer::OldestArrival()
+{
+	LONGLONG oldest = m_Entries[0].ArrivalTime;
+
+	for (UINT32 i = 1; i < m_nEntries; i++)
+	{
+		if (m_Entries[i].ArrivalTime < oldest)
+		{
+			oldest = m_Entries[i].ArrivalTime;
+		}
+	}
+
+	return oldest;
+}
+
+/*
+TRUE if no report older than pReport can still arrive: it's of the frame released last, which
+makes any older report late anyway, or that frame is complete and pReport is of the next scan.
+*/
+BOOL CReorderBuffer::IsInOrder(_In_ const HID_TOUCH_REPORT *pReport)
+{
+	INT16 diff;
+
+	if (m_fReleased == FALSE)
+	{
+		return FALSE;
+	}
+
+	diff = TimestampDiff(pReport->Timestamp, m_LastReleased);
+	if (diff <= 0)
+	{
+		return TRUE;
+	}
+
+	return (m_nLastReleased >= m_nLastContacts && m_ScanPeriod != 0 && diff <= m_ScanPeriod) ? TRUE : FALSE;
+}
+
+void CReorderBuffer::NoteReleased(_In_ const HID_TOUCH_REPORT *pReport)
+{
+	INT16 diff = TimestampDiff(pReport->Timestamp, m_LastReleased);
+
+	if (m_fReleased == FALSE || diff > 0)
+	{
+		if (m_fReleased && (m_ScanPeriod == 0 || diff < m_ScanPeriod))
+		{
+			m_ScanPeriod = diff;
+		}
+		m_LastReleased = pReport->Timestamp;
+		m_nLastReleased = 1;
+		m_nLastContacts = pReport->nContacts;
+		m_fReleased = TRUE;
+	}
+	else if (diff == 0)
+	{
+		m_nLastReleased++;
+	}
+	// A late lift-off doesn't take m_LastReleased back.
+
+	if ((m_IdReleased[pReport->ContactId / 32] & (1u << (pReport->ContactId % 32))) == 0 ||
+		TimestampDiff(pReport->Timestamp, m_IdTimestamp[pReport->ContactId]) > 0)
+	{
+		m_IdTimestamp[pReport->ContactId] = pReport->Timestamp;
+		m_IdReleased[pReport->ContactId / 32] |= (1u << (pReport->ContactId % 32));
+	}
+}
+
+/*
+Move out the reports which waited long enough, oldest timestamp first. The oldest report waits
+at most REORDER_HOLD_US after its arrival, and one entry is always kept free for Insert().
+A report which is in order doesn't wait at all.
+Returns the number of reports written to pReports.
+*/
+UINT32 CReorderBuffer::Release(LONGLONG now, _Out_writes_(maxReports) HID_TOUCH_REPORT *pReports, UINT32 maxReports)
+{
+	UINT32 nReleased = 0;
+
+	while (m_nEntries > 0 && nReleased < maxReports)
+	{
+		if (m_nEntries < REORDER_CAPACITY && !IsInOrder(&m_Entries[0].Report) && now - OldestArrival() < m_HoldTicks)
+		{
+			break;
+		}
+
+		pReports[nReleased++] = m_Entries[0].Report;
+		NoteReleased(&m_Entries[0].Report);
+
+		m_nEntries--;
+		MoveMemory(&m_Entries[0], &m_Entries[1], m_nEntries * sizeof(REORDER_ENTRY));
+	}
+
+	return nReleased;
+}
+
+LONGLONG CReorderBuffer::NextDeadline()
+{
+	if (m_nEntries == 0)
+	{
+		return 0;
+	}
+
+	return OldestArrival() + m_HoldTicks;
+}
+
+//
+// Implementions of CTouchClock.
+//
+CTouchClock::CTouchClock()
+{
+	LARGE_INTEGER frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	m_QpcFrequency = frequency.QuadPart;
+
+	m_fStarted = FALSE;
+	m_LastTimestamp = 0;
+	m_LastUs = 0;
+	m_LastArrival = 0;
+	m_nWraps = 0;
+}
+
+ULONGLONG CTouchClock::Unwrap(UINT16 timestamp, LONGLONG arrival)
+{
+	const LONGLONG periodUs = 0x10000LL * TOUCH_TIMESTAMP_UNIT_US;
+	LONGLONG elapsedUs;
+	LONGLONG deltaUs;
+	LONGLONG diffUs;
+	LONGLONG nWraps;
+
+	if (m_fStarted == FALSE)
+	{	// Start on the host clock, so that the times read like QueryPerformanceCounter() ones.
+		m_fStarted = TRUE;
+		m_LastTimestamp = timestamp;
+		m_LastUs = (ULONGLONG)(arrival / m_QpcFrequency * 1000000 + arrival % m_QpcFrequency * 1000000 / m_QpcFrequency);
+		m_LastArrival = arrival;
+		return m_LastUs;
+	}
+
+	elapsedUs = (arrival - m_LastArrival) * 1000000 / m_QpcFrequency;
+	deltaUs = (LONGLONG)(UINT16)(timestamp - m_LastTimestamp) * TOUCH_TIMESTAMP_UNIT_US;
+
+	// Whole periods the host saw pass on top of the counter delta, rounded to the nearest.
+	// It's -1 for a timestamp just older than the last one.
+	diffUs = elapsedUs - deltaUs;
+	if (diffUs >= 0)
+	{
+		nWraps = (diffUs + periodUs / 2) / periodUs;
+	}
+	else
+	{
+		nWraps = -((-diffUs + periodUs / 2) / periodUs);
+	}
+
+	deltaUs += nWraps * periodUs;
+	if (deltaUs < 0)
+	{	// Older than the last one. Time doesn't go back.
+		return m_LastUs;
+	}
+
+	if (nWraps > 0)
+	{
+		InterlockedExchangeAdd(&m_nWraps, (LONG)nWraps);
+	}
+
+	m_LastTimestamp = timestamp;
+	m_LastUs += deltaUs;
+	m_LastArrival = arrival;
+
+	return m_LastUs;
+}
+
+//
+// Implementions of CFrameAssembler.
+//
+CFrameAssembler::CFrameAssembler()
+{
+	LARGE_INTEGER frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	m_HoldTicks = frequency.QuadPart * FRAME_HOLD_US / 1000000;
+
+	m_Frame.Timestamp = 0;
+	m_Frame.TimeUs = 0;
+	m_Frame.nContacts = 0;
+	m_nExpected = 0;
+	m_FirstArrival = 0;
+
+	m_pfnFrameCallback = NULL;
+	m_pContext = NULL;
+
+	m_nFrames = 0;
+	m_nPartialFrames = 0;
+}
+
+void CFrameAssembler::SetFrameCallback(void *pContext, PFN_TOUCH_FRAME_CALLBACK pfnCallback)
+{
+	m_pContext = pContext;
+	m_pfnFrameCallback = pfnCallback;
+}
+
+void CFrameAssembler::DeliverFrame()
+{
+	InterlockedIncrement(&m_nFrames);
+	if (m_Frame.nContacts < m_nExpected)
+	{
+		InterlockedIncrement(&m_nPartialFrames);
+	}
+
+	m_Frame.TimeUs = m_Clock.Unwrap(m_Frame.Timestamp, m_FirstArrival);
+
+	(*m_pfnFrameCallback)(m_pContext, &m_Frame);
+
+	m_Frame.nContacts = 0;
+}
+
+void CFrameAssembler::Add(_In_ const HID_TOUCH_REPORT *pReport, LONGLONG now)
+{
+	UINT32 i;
+
+	if (m_Frame.nContacts != 0 && m_Frame.Timestamp != pReport->Timestamp)
+	{	// The pending frame won't get any more contacts.
+		DeliverFrame();
+	}
+
+	if (m_Frame.nContacts == 0)
+	{
+		m_Frame.Timestamp = pReport->Timestamp;
+		m_FirstArrival = now;
+
+		m_nExpected = pReport->nContacts;
+		if (m_nExpected == 0) m_nExpected = 1;
+		if (m_nExpected > MAX_TOUCH_POINT) m_nExpected = MAX_TOUCH_POINT;
+	}
+
+	// A contact reported twice in a frame keeps its latest report.
+	for (i = 0; i < m_Frame.nContacts; i++)
+	{
+		if (m_Frame.Contacts[i].ContactId == pReport->ContactId)
+		{
+			break;
+		}
+	}
+
+	if (i == MAX_TOUCH_POINT)
+	{
+		Trace(TRACE_LEVEL_ERROR, "Too many contacts in a frame.\n");
+		DeliverFrame();
+		Add(pReport, now);
+		return;
+	}
+
+	m_Frame.Contacts[i] = *pReport;
+	if (i == m_Frame.nContacts)
+	{
+		m_Frame.nContacts++;
+	}
+
+	if (m_Frame.nContacts >= m_nExpected)
+	{
+		DeliverFrame();
+	}
+}
+
+/*
+Deliver the pending frame if it has waited FRAME_HOLD_US for its missing contacts.
+*/
+void CFrameAssembler::Flush(LONGLONG now)
+{
+	if (m_Frame.nContacts != 0 && now - m_FirstArrival >= m_HoldTicks)
+	{
+		DeliverFrame();
+	}
+}
+
+LONGLONG CFrameAssembler::NextDeadline()
+{
+	if (m_Frame.nContacts == 0)
+	{
+		return 0;
+	}
+
+	return m_FirstArrival + m_HoldTicks;
+}
+
+//
+// Implementions of CJitterFilter.
+//
+CJitterFilter::CJitterFilter()
+{
+	for (int i = 0; i < MAX_TOUCH_POINT; i++)
+	{
+		m_States[i].X = 0;
+		m_States[i].Y = 0;
+		m_States[i].Speed = 0;
+		m_States[i].TimeUs = 0;
+	}
+	m_nHeld = 0;
+}
+
+/*
+	Smoothing factor of a first order low-pass at cutoff mHz for a sample dtUs after the last
+	one, in 1/65536. alpha = w / (w + 1) with w = 2 * pi * cutoff * dt.
+*/
+UINT32 CJitterFilter::GetAlpha(UINT32 cutoff, ULONGLONG dtUs)
+{
+	ULONGLONG w = 6283ULL * cutoff * dtUs;		// In 1e-12, at most 6.3e13 within the limits.
+
+	return (UINT32)((w << 16) / (w + 1000000000000ULL));
+}
+
+void CJitterFilter::Apply(_Inout_ TOUCH_FRAME *pFrame)
+{
+	for (UINT32 i = 0; i < pFrame->nContacts; i++)
+	{
+		HID_TOUCH_REPORT *pContact = &pFrame->Contacts[i];
+		int slot = m_ContactIds.Lookup(pContact->ContactId);
+		BOOL fNew = FALSE;
+
+		if (slot == CONTACT_NO_SLOT && pContact->bStatus == TRUE)
+		{
+			slot = m_ContactIds.Insert(pContact->ContactId);
+			fNew = TRUE;
+		}
+
+		if (slot == CONTACT_NO_SLOT)
+		{	// Unknown release, or too many contacts. Goes through as it is.
+			continue;
+		}
+
+		JITTER_STATE *pState = &m_States[slot];
+		const INT32 half = 1 << (JITTER_POSITION_SHIFT - 1);
+		INT32 rawX = pContact->wXData << JITTER_POSITION_SHIFT;
+		INT32 rawY = pContact->wYData << JITTER_POSITION_SHIFT;
+		INT32 lastX = (pState->X + half) >> JITTER_POSITION_SHIFT;
+		INT32 lastY = (pState->Y + half) >> JITTER_POSITION_SHIFT;
+		ULONGLONG dtUs = pFrame->TimeUs - pState->TimeUs;
+
+		if (fNew || cEnabled == FALSE || dtUs > JITTER_RESET_US)
+		{	// Start over from the raw position.
+			pState->X = rawX;
+			pState->Y = rawY;
+			pState->Speed = 0;
+			pState->TimeUs = pFrame->TimeUs;
+		}
+		else
+		{
+			if (dtUs != 0)
+			{
+				INT32 dX = rawX - pState->X;
+				INT32 dY = rawY - pState->Y;
+
+				// The speed is smoothed too, so that a single noisy sample doesn't open the filter.
+				INT64 speed = (INT64)((ULONGLONG)(abs(dX) + abs(dY)) * 1000000 / dtUs) >> JITTER_POSITION_SHIFT;
+				pState->Speed += (INT32)(((speed - (INT64)pState->Speed) * GetAlpha(cSpeedCutoff, dtUs)) >> 16);
+
+				ULONGLONG cutoff = cMinCutoff + (ULONGLONG)cBeta * pState->Speed / 1000;
+				if (cutoff > JITTER_MAX_CUTOFF_MHZ) cutoff = JITTER_MAX_CUTOFF_MHZ;
+
+				UINT32 alpha = GetAlpha((UINT32)cutoff, dtUs);
+				pState->X += (INT32)(((INT64)dX * alpha) >> 16);
+				pState->Y += (INT32)(((INT64)dY * alpha) >> 16);
+				pState->TimeUs = pFrame->TimeUs;
+			}
+
+			pContact->wXData = (pState->X + half) >> JITTER_POSITION_SHIFT;
+			pContact->wYData = (pState->Y + half) >> JITTER_POSITION_SHIFT;
+
+			if (pContact->wXData == lastX && pContact->wYData == lastY
+				&& ((rawX >> JITTER_POSITION_SHIFT) != lastX || (rawY >> JITTER_POSITION_SHIFT) != lastY))
+			{
+				InterlockedIncrement(&m_nHeld);
+			}
+		}
+
+		if (pContact->bStatus != TRUE)
+		{	// The contact is up, its slot is free for the next one.
+			m_ContactIds.Remove(pContact->ContactId);
+		}
+	}
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "Gesture.h"
+
+//
+// Stages between the touch read completions and the gesture engine.
+//
+
+#define REORDER_CAPACITY	32		// Reports held at most by the reorder buffer.
+#define REORDER_HOLD_US		2000	// Longest time a report waits for older reports to arrive.
+#define REORDER_CONTACT_IDS	256		// HID_TOUCH_REPORT::ContactId is a UCHAR.
+#define FRAME_HOLD_US		4000	// Longest time a frame waits for its missing contacts.
+#define TOUCH_TIMESTAMP_UNIT_US	100	// HID_TOUCH_REPORT::Timestamp counts the scan time in 100 us units.
+
+// Defaults of CJitterFilter. Frequencies are in mHz.
+#define JITTER_MIN_CUTOFF_MHZ	1000	// Cutoff of a resting finger. Lower is steadier but lags more.
+#define JITTER_BETA_MHZ			1500	// Cutoff added per 1000 units/s of speed. Higher lags less on fast moves.
+#define JITTER_SPEED_CUTOFF_MHZ	1000	// Cutoff of the speed estimate.
+#define JITTER_MAX_CUTOFF_MHZ	100000
+#define JITTER_RESET_US			100000	// A contact which didn't report for this long starts over unfiltered.
+#define JITTER_POSITION_SHIFT	4		// The filtered positions have 4 fraction bits.
+
+// Signed distance between two 16-bit device timestamps. Positive if a is newer than b.
+inline INT16 TimestampDiff(UINT16 a, UINT16 b)
+{
+	return (INT16)(UINT16)(a - b);
+}
+
+//
+// Puts reports back into HID_TOUCH_REPORT::Timestamp order when completions of concurrent
+// requests arrive out of order. A report is held until it is REORDER_HOLD_US old or the buffer
+// is full, and reports are always released oldest timestamp first.
+// A report goes out right away when nothing older can still be in flight: it belongs to the
+// frame released last, or that frame is complete and the report is of the next scan.
+// Not thread-safe. The caller serializes Insert() and Release().
+//
+class CReorderBuffer
+{
+private:
+	struct REORDER_ENTRY
+	{
+		HID_TOUCH_REPORT Report;
+		LONGLONG ArrivalTime;		// QueryPerformanceCounter() value.
+	};
+
+	REORDER_ENTRY m_Entries[REORDER_CAPACITY];	// Sorted by Timestamp, oldest first.
+	UINT32 m_nEntries;
+	BOOL m_fReleased;				// TRUE once any report was released.
+	UINT16 m_LastReleased;			// Newest timestamp released. Never goes back.
+	UINT32 m_nLastReleased;			// Reports released with the timestamp m_LastReleased.
+	UINT32 m_nLastContacts;			// HID_TOUCH_REPORT::nContacts of the frame m_LastReleased.
+	UINT16 m_ScanPeriod;			// Smallest step between two released timestamps. 0 until known.
+	LONGLONG m_HoldTicks;			// REORDER_HOLD_US in QueryPerformanceCounter() ticks.
+
+	UINT16 m_IdTimestamp[REORDER_CONTACT_IDS];		// Timestamp of the last released report of each contact ID.
+	UINT32 m_IdReleased[REORDER_CONTACT_IDS / 32];	// Contact IDs which have an entry in m_IdTimestamp.
+
+	LONGLONG OldestArrival();
+	BOOL IsInOrder(_In_ const HID_TOUCH_REPORT *pReport);
+	void NoteReleased(_In_ const HID_TOUCH_REPORT *pReport);
+
+public:
+	volatile LONG m_nReordered;		// Reports which arrived before an older report.
+	volatile LONG m_nLate;			// Reports older than a report already released.
+	volatile LONG m_nDropped;		// Late contact moves and stale lift-offs, and reports which didn't fit.
+
+public:
+	CReorderBuffer();
+
+	void Insert(_In_ const HID_TOUCH_REPORT *pReport, LONGLONG now);
+	UINT32 Release(LONGLONG now, _Out_writes_(maxReports) HID_TOUCH_REPORT *pReports, UINT32 maxReports);
+
+	// QueryPerformanceCounter() value when Release() has something to do. 0 if empty.
+	LONGLONG NextDeadline();
+	BOOL IsEmpty()
+	{
+		return (m_nEntries == 0) ? TRUE : FALSE;
+	}
+};
+
+//
+// Unwraps the 16-bit device timestamp into monotonic microseconds. The counter wraps every
+// 6.5 s, so the arrival times on QueryPerformanceCounter() tell how many wraps passed between
+// two frames. The device time itself is kept for the precise deltas.
+// Not thread-safe. The caller serializes Unwrap().
+//
+class CTouchClock
+{
+private:
+	BOOL m_fStarted;
+	UINT16 m_LastTimestamp;
+	ULONGLONG m_LastUs;				// Unwrapped time of m_LastTimestamp.
+	LONGLONG m_LastArrival;			// QueryPerformanceCounter() value of m_LastTimestamp.
+	LONGLONG m_QpcFrequency;
+
+public:
+	volatile LONG m_nWraps;			// Counter wraps which the arrival times had to resolve.
+
+public:
+	CTouchClock();
+
+	// Microseconds of the timestamp. A timestamp older than the last one gets the last time.
+	ULONGLONG Unwrap(UINT16 timestamp, LONGLONG arrival);
+};
+
+typedef void (*PFN_TOUCH_FRAME_CALLBACK)(void *pContext, const TOUCH_FRAME *pFrame);
+
+//
+// Groups the reports of one frame, the contacts which share a timestamp. The device sends one
+// report per contact and HID_TOUCH_REPORT::nContacts tells how many belong to the frame.
+// A frame is delivered as soon as all of its contacts arrived. A report of a newer frame, or
+// FRAME_HOLD_US passing, delivers an incomplete frame as it is.
+// Not thread-safe. The caller serializes all the methods.
+//
+class CFrameAssembler
+{
+private:
+	TOUCH_FRAME m_Frame;			// Frame being assembled. Empty if nContacts is 0.
+	UINT32 m_nExpected;				// Contacts announced for m_Frame.
+	LONGLONG m_FirstArrival;		// QueryPerformanceCounter() value of the first report of m_Frame.
+	LONGLONG m_HoldTicks;			// FRAME_HOLD_US in QueryPerformanceCounter() ticks.
+
+	CTouchClock m_Clock;			// Gives TOUCH_FRAME::TimeUs.
+
+	PFN_TOUCH_FRAME_CALLBACK m_pfnFrameCallback;
+	void *m_pContext;
+
+	void DeliverFrame();
+
+public:
+	volatile LONG m_nFrames;		// Frames delivered.
+	volatile LONG m_nPartialFrames;	// Frames delivered before all of their contacts arrived.
+
+public:
+	CFrameAssembler();
+
+	void SetFrameCallback(void *pContext, PFN_TOUCH_FRAME_CALLBACK pfnCallback);
+
+	void Add(_In_ const HID_TOUCH_REPORT *pReport, LONGLONG now);
+	void Flush(LONGLONG now);
+
+	// QueryPerformanceCounter() value when Flush() has something to do. 0 if no frame is pending.
+	LONGLONG NextDeadline();
+};
+
+//
+// Adaptive low-pass filter of the contact positions, after the 1 Euro filter. The cutoff grows
+// with the speed of the contact, so a resting finger is smoothed heavily and its sensor noise
+// doesn't move the cursor, while a fast move goes through with little lag. Integer math only.
+// Not thread-safe. The caller serializes Apply().
+//
+class CJitterFilter
+{
+private:
+	struct JITTER_STATE
+	{
+		INT32 X;			// Filtered position, JITTER_POSITION_SHIFT fraction bits.
+		INT32 Y;
+		UINT32 Speed;		// Filtered |dx| + |dy| in device units per second.
+		ULONGLONG TimeUs;	// Time of the last sample.
+	};
+
+	JITTER_STATE m_States[MAX_TOUCH_POINT];
+	CContactIdMap m_ContactIds;		// Slots of m_States by contact ID.
+
+	static UINT32 GetAlpha(UINT32 cutoff, ULONGLONG dtUs);
+
+public:
+	volatile LONG m_nHeld;			// Contact moves which the filter held back.
+
+	BOOL cEnabled = TRUE;
+	UINT32 cMinCutoff = JITTER_MIN_CUTOFF_MHZ;
+	UINT32 cBeta = JITTER_BETA_MHZ;
+	UINT32 cSpeedCutoff = JITTER_SPEED_CUTOFF_MHZ;
+
+public:
+	CJitterFilter();
+
+	// Replaces the positions of the contacts in the frame with the filtered positions.
+	void Apply(_Inout_ TOUCH_FRAME *pFrame);
+};
@@ -219,6 +219,17 @@ typedef struct _HID_TOUCH_REPORT
 	UCHAR  nContacts;
 } HID_TOUCH_REPORT, *PHID_TOUCH_REPORT;
 
+#define MAX_TOUCH_REPORT_BATCH	32	// Maximum reports returned by one IOCTL_SELFTEST_GET_INPUT_REPORT_BATCH.
+
+// Output of IOCTL_SELFTEST_GET_INPUT_REPORT_BATCH.
+// The lower filter fills it with every report queued since the last completion, oldest first.
+
+typedef struct _HID_TOUCH_REPORT_BATCH
+{
+	UINT32 nReports;	// Number of valid entries in Reports.
+	HID_TOUCH_REPORT Reports[MAX_TOUCH_REPORT_BATCH];
+} HID_TOUCH_REPORT_BATCH, *PHID_TOUCH_REPORT_BATCH;
+
 #pragma pack(pop)
 
 // {90F8B231-97E6-4128-803E-7657EA5F2063}
@@ -229,6 +240,8 @@ DEFINE_GUID(GUID_TOUCH_SELFTEST_INTERFACE, 0x90f8b231, 0x97e6, 0x4128, 0x80, 0x3
 	CTL_CODE(FILE_DEVICE_TOUCHDEV, 0x001, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_SELFTEST_BLOCK_TOUCH_REPORT      \
 	CTL_CODE(FILE_DEVICE_TOUCHDEV, 0x002, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_SELFTEST_GET_INPUT_REPORT_BATCH      \
+	CTL_CODE(FILE_DEVICE_TOUCHDEV, 0x003, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
 #define MAX_DEVPATH_LENGTH 256
 
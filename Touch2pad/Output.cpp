@@ -0,0 +1,222 @@
+#include "internal.h"
+#if defined(EVENT_TRACING)
+#include "output.tmh"
+#endif
+#include "Output.h"
+
+static INT32 Clamp(INT32 value, INT32 minValue, INT32 maxValue)
+{
+	if (value < minValue) return minValue;
+	if (value > maxValue) return maxValue;
+	return value;
+}
+
+//
+// Implementions of CWaitHistogram.
+//
+CWaitHistogram::CWaitHistogram()
+{
+	ZeroMemory((PVOID)m_Buckets, sizeof(m_Buckets));
+}
+
+void CWaitHistogram::Add(ULONGLONG waitUs)
+{
+	UINT32 bucket = 0;
+
+	while (bucket < WAIT_HISTOGRAM_BUCKETS - 1 && (1ULL << bucket) <= waitUs)
+	{
+		bucket++;
+	}
+
+	InterlockedIncrement(&m_Buckets[bucket]);
+}
+
+ULONGLONG CWaitHistogram::GetPercentile(UINT32 percentile)
+{
+	ULONGLONG total = 0;
+	ULONGLONG count = 0;
+
+	for (UINT32 i = 0; i < WAIT_HISTOGRAM_BUCKETS; i++)
+	{
+		total += m_Buckets[i];
+	}
+
+	if (total == 0)
+	{
+		return 0;
+	}
+
+	for (UINT32 i = 0; i < WAIT_HISTOGRAM_BUCKETS; i++)
+	{
+		count += m_Buckets[i];
+		if (count * 100 >= total * percentile)
+		{
+			return 1ULL << i;
+		}
+	}
+
+	return 1ULL << (WAIT_HISTOGRAM_BUCKETS - 1);
+}
+
+//
+// Implementions of COutputQueue.
+//
+COutputQueue::COutputQueue()
+{
+	LARGE_INTEGER frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	m_Frequency = frequency.QuadPart;
+
+	m_nButtons = 0;
+	m_QueuedButtons = 0;
+	m_ReportedButtons = 0;
+	m_ReportedX = 0;
+	m_ReportedY = 0;
+
+	ZeroMemory(m_MotionLane, sizeof(m_MotionLane));
+
+	m_nMerged = 0;
+	m_nDropped = 0;
+}
+
+void COutputQueue::Add(_In_ const MOUSE_OUTPUT_EVENT *pEvent, LONGLONG now)
+{
+	MOTION_ENTRY *pEntry;
+
+	if (pEvent->Buttons != m_QueuedButtons)
+	{
+		if (m_nButtons == OUTPUT_BUTTON_DEPTH)
+		{
+			Trace(TRACE_LEVEL_ERROR, "COutputQueue: Button transition dropped.\n");
+			InterlockedIncrement(&m_nDropped);
+		}
+		else
+		{
+			m_ButtonLane[m_nButtons].Buttons = pEvent->Buttons;
+			m_ButtonLane[m_nButtons].EnqueueTime = now;
+			m_nButtons++;
+			m_QueuedButtons = pEvent->Buttons;
+		}
+	}
+
+	if (pEvent->dx == 0 && pEvent->dy == 0 && pEvent->dWheel == 0)
+	{
+		return;
+	}
+
+	// The motion belongs to the epoch after the last queued transition.
+	pEntry = &m_MotionLane[m_nButtons];
+	if (pEntry->fMotion)
+	{
+		InterlockedIncrement(&m_nMerged);
+	}
+	else
+	{
+		pEntry->EnqueueTime = now;
+		pEntry->fMotion = TRUE;
+	}
+
+#if ABSOLUTE_ASIX
+	pEntry->Motion.dx = pEvent->dx;
+	pEntry->Motion.dy = pEvent->dy;
+#else
+	pEntry->Motion.dx += pEvent->dx;
+	pEntry->Motion.dy += pEvent->dy;
+#endif
+	pEntry->Motion.dWheel += pEvent->dWheel;
+}
+
+/*
+The transition at the head of the lane is sent, so the next epoch begins. Motion of the
+sent epoch which didn't fit into the report goes out with the next one.
+*/
+void COutputQueue::CloseEpoch()
+{
+	MOTION_ENTRY *pSent = &m_MotionLane[0];
+	MOTION_ENTRY *pNext = &m_MotionLane[1];
+
+	if (pSent->fMotion)
+	{
+		if (pNext->fMotion)
+		{
+#if !ABSOLUTE_ASIX
+			pNext->Motion.dx += pSent->Motion.dx;
+			pNext->Motion.dy += pSent->Motion.dy;
+#endif
+			pNext->Motion.dWheel += pSent->Motion.dWheel;
+			pNext->EnqueueTime = pSent->EnqueueTime;
+		}
+		else
+		{
+			*pNext = *pSent;
+		}
+	}
+
+	m_nButtons--;
+	MoveMemory(&m_ButtonLane[0], &m_ButtonLane[1], m_nButtons * sizeof(BUTTON_ENTRY));
+	MoveMemory(&m_MotionLane[0], &m_MotionLane[1], (m_nButtons + 1) * sizeof(MOTION_ENTRY));
+	ZeroMemory(&m_MotionLane[m_nButtons + 1], sizeof(MOTION_ENTRY));
+}
+
+BOOL COutputQueue::PeekReport(_Out_ MOUSE_OUTPUT_EVENT *pReport)
+{
+	if (IsEmpty())
+	{
+		return FALSE;
+	}
+
+	// A button transition has strict priority. Only the motion of its epoch rides along.
+	const MOUSE_OUTPUT_EVENT *pMotion = &m_MotionLane[0].Motion;
+
+	pReport->Buttons = (m_nButtons != 0) ? m_ButtonLane[0].Buttons : m_ReportedButtons;
+#if ABSOLUTE_ASIX
+	// A click without a move of its own must not jump to (0, 0).
+	pReport->dx = m_MotionLane[0].fMotion ? pMotion->dx : m_ReportedX;
+	pReport->dy = m_MotionLane[0].fMotion ? pMotion->dy : m_ReportedY;
+#else
+	pReport->dx = Clamp(pMotion->dx, MOUSE_DELTA_MIN, MOUSE_DELTA_MAX);
+	pReport->dy = Clamp(pMotion->dy, MOUSE_DELTA_MIN, MOUSE_DELTA_MAX);
+#endif
+	pReport->dWheel = Clamp(pMotion->dWheel, MOUSE_WHEEL_MIN, MOUSE_WHEEL_MAX);
+
+	return TRUE;
+}
+
+void COutputQueue::ConsumeReport(_In_ const MOUSE_OUTPUT_EVENT *pReport, LONGLONG now)
+{
+	MOTION_ENTRY *pEntry = &m_MotionLane[0];
+	BOOL fSent;
+
+	if (pEntry->fMotion)
+	{
+#if ABSOLUTE_ASIX
+		// A position is not used up. It stays for the wheel which didn't fit into the report.
+		pEntry->Motion.dWheel -= pReport->dWheel;
+		fSent = (pEntry->Motion.dWheel == 0) ? TRUE : FALSE;
+#else
+		pEntry->Motion.dx -= pReport->dx;
+		pEntry->Motion.dy -= pReport->dy;
+		pEntry->Motion.dWheel -= pReport->dWheel;
+		fSent = (pEntry->Motion.dx == 0 && pEntry->Motion.dy == 0 && pEntry->Motion.dWheel == 0) ? TRUE : FALSE;
+#endif
+
+		// Keep only the motion which didn't fit into the report.
+		if (fSent)
+		{
+			m_MotionWait.Add((ULONGLONG)(now - pEntry->EnqueueTime) * 1000000 / m_Frequency);
+			pEntry->fMotion = FALSE;
+		}
+	}
+
+	if (m_nButtons != 0)
+	{
+		m_ButtonWait.Add((ULONGLONG)(now - m_ButtonLane[0].EnqueueTime) * 1000000 / m_Frequency);
+		CloseEpoch();
+	}
+	m_ReportedButtons = pReport->Buttons;
+#if ABSOLUTE_ASIX
+	m_ReportedX = pReport->dx;
+	m_ReportedY = pReport->dy;
+#endif
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+//
+// Stages between the gesture engine and the HID read requests.
+//
+
+#define OUTPUT_BUTTON_DEPTH	8		// Button transitions which can wait for a read request.
+#define WAIT_HISTOGRAM_BUCKETS	32	// Bucket i counts waits below 2^i microseconds.
+
+#define MOUSE_DELTA_MIN		(-1024)	// Logical range of X and Y in G_DefaultReportDescriptor.
+#define MOUSE_DELTA_MAX		1023
+#define MOUSE_WHEEL_MIN		(-127)	// Logical range of the wheel.
+#define MOUSE_WHEEL_MAX		127
+
+// One mouse event of the gesture engine, or one report for the HID class driver.
+typedef struct _MOUSE_OUTPUT_EVENT
+{
+	INT32 dx;
+	INT32 dy;
+	INT32 dWheel;
+	INT8 Buttons;
+} MOUSE_OUTPUT_EVENT, *PMOUSE_OUTPUT_EVENT;
+
+//
+// Log2 histogram of queue wait times, good enough to read percentiles from.
+//
+class CWaitHistogram
+{
+private:
+	volatile LONG m_Buckets[WAIT_HISTOGRAM_BUCKETS];
+
+public:
+	CWaitHistogram();
+
+	void Add(ULONGLONG waitUs);
+	// Upper bound in microseconds of the bucket holding the given percentile. 0 if empty.
+	ULONGLONG GetPercentile(UINT32 percentile);
+};
+
+//
+// Holds the mouse events until the HID class driver sends IOCTL_HID_READ_REPORT.
+// Button transitions wait in a bounded FIFO and always go out first, in order.
+// Relative motion and wheel are summed per button epoch, the time between two queued
+// transitions, so no distance is lost and motion can never hold a click back. A button report
+// carries the motion which came before its transition, never the motion queued after it.
+// Motion beyond the logical range of one report is carried to the next one.
+// With ABSOLUTE_ASIX an epoch keeps its latest position instead, and a report of an epoch
+// without one repeats the last reported position.
+// Not thread-safe. The caller serializes all the methods.
+//
+class COutputQueue
+{
+private:
+	struct BUTTON_ENTRY
+	{
+		INT8 Buttons;
+		LONGLONG EnqueueTime;		// QueryPerformanceCounter() value.
+	};
+
+	struct MOTION_ENTRY
+	{
+		MOUSE_OUTPUT_EVENT Motion;	// Pending motion. Buttons is not used.
+		BOOL fMotion;				// TRUE if Motion holds motion.
+		LONGLONG EnqueueTime;		// QueryPerformanceCounter() value of the oldest motion in Motion.
+	};
+
+	BUTTON_ENTRY m_ButtonLane[OUTPUT_BUTTON_DEPTH];	// FIFO of button transitions.
+	UINT32 m_nButtons;
+	INT8 m_QueuedButtons;			// Button state after the last queued transition.
+	INT8 m_ReportedButtons;			// Button state of the last report.
+	INT32 m_ReportedX;				// Position of the last report, with ABSOLUTE_ASIX.
+	INT32 m_ReportedY;
+
+	// Motion of each button epoch. Entry i came before the transition i and goes out with it,
+	// entry m_nButtons came after all of them. The entries beyond m_nButtons are empty.
+	MOTION_ENTRY m_MotionLane[OUTPUT_BUTTON_DEPTH + 1];
+
+	LONGLONG m_Frequency;			// QueryPerformanceFrequency()
+
+	void CloseEpoch();
+
+public:
+	volatile LONG m_nMerged;		// Motion events merged into the pending slot.
+	volatile LONG m_nDropped;		// Button transitions dropped because the lane was full.
+	CWaitHistogram m_ButtonWait;	// How long button transitions waited for a read request.
+	CWaitHistogram m_MotionWait;	// How long motion waited for a read request.
+
+public:
+	COutputQueue();
+
+	void Add(_In_ const MOUSE_OUTPUT_EVENT *pEvent, LONGLONG now);
+
+	// The next report to send, clamped to the logical ranges. FALSE if nothing is pending.
+	BOOL PeekReport(_Out_ MOUSE_OUTPUT_EVENT *pReport);
+	// Remove what PeekReport() returned once it is sent.
+	void ConsumeReport(_In_ const MOUSE_OUTPUT_EVENT *pReport, LONGLONG now);
+
+	BOOL IsEmpty()
+	{
+		return (m_nButtons == 0 && m_MotionLane[0].fMotion == FALSE) ? TRUE : FALSE;
+	}
+};
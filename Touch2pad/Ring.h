@@ -0,0 +1,142 @@
+#pragma once
+
+//
+// Lock-free multi-producer/single-consumer ring which stores entries by value.
+// Push() may be called from any number of threads at once, Pop() from one other thread only.
+// Capacity must be a power of two.
+//
+// A producer reserves a run of entries by moving the tail with a compare-exchange, copies its
+// entries in, then publishes each of them with its sequence number. The consumer only takes
+// published entries, in order, so a producer which reserved first but copies slower holds back
+// the entries of the later producers until it is done.
+//
+template <typename T, UINT32 Capacity>
+class CMpscRing
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two.");
+
+private:
+	// Head and tail are free-running counters on their own cache lines, so that the producers
+	// and the consumer don't invalidate each other's line on every entry.
+	volatile LONG	m_Head;		// Next entry to pop. Written by the consumer only.
+	BYTE			m_HeadPad[SYSTEM_CACHE_ALIGNMENT_SIZE - sizeof(LONG)];
+	volatile LONG	m_Tail;		// Next entry to reserve. Moved by the producers with a compare-exchange.
+	BYTE			m_TailPad[SYSTEM_CACHE_ALIGNMENT_SIZE - sizeof(LONG)];
+
+	volatile LONG	m_Sequence[Capacity];	// Counter + 1 of the entry published in each slot.
+	T				m_Entries[Capacity];
+
+	BOOL IsPublished(LONG position)
+	{
+		return (m_Sequence[(UINT32)position & (Capacity - 1)] == position + 1) ? TRUE : FALSE;
+	}
+
+public:
+	volatile LONG	m_nOverflows;	// Entries dropped because the ring was full.
+	volatile LONG	m_HighWater;	// Highest occupancy seen by the producers.
+
+public:
+	CMpscRing() :
+		m_Head(0),
+		m_Tail(0),
+		m_nOverflows(0),
+		m_HighWater(0)
+	{
+		// No slot is published. Slot i waits for the sequence i + 1.
+		for (UINT32 i = 0; i < Capacity; i++)
+		{
+			m_Sequence[i] = 0;
+		}
+	}
+
+	// Copy in as many entries as fit. The rest are dropped and counted. Returns the number pushed.
+	UINT32 Push(_In_reads_(nEntries) const T *pEntries, UINT32 nEntries)
+	{
+		LONG tail = m_Tail;
+		UINT32 nUsed;
+		UINT32 nPush;
+
+		// Reserve the entries. The head may only move on meanwhile, which leaves more room.
+		for (;;)
+		{
+			LONG prev;
+
+			nUsed = (UINT32)(tail - m_Head);
+			nPush = (nEntries < Capacity - nUsed) ? nEntries : Capacity - nUsed;
+			if (nPush == 0)
+			{
+				break;
+			}
+
+			prev = InterlockedCompareExchange(&m_Tail, tail + nPush, tail);
+			if (prev == tail)
+			{
+				break;
+			}
+			tail = prev;
+		}
+
+		for (UINT32 i = 0; i < nPush; i++)
+		{
+			m_Entries[(UINT32)(tail + i) & (Capacity - 1)] = pEntries[i];
+		}
+
+		// Entries must be visible before the consumer sees them published.
+		MemoryBarrier();
+		for (UINT32 i = 0; i < nPush; i++)
+		{
+			m_Sequence[(UINT32)(tail + i) & (Capacity - 1)] = tail + (LONG)i + 1;
+		}
+
+		if (nPush < nEntries)
+		{
+			InterlockedExchangeAdd(&m_nOverflows, (LONG)(nEntries - nPush));
+		}
+
+		if ((LONG)(nUsed + nPush) > m_HighWater)
+		{
+			m_HighWater = nUsed + nPush;
+		}
+
+		return nPush;
+	}
+
+	// Copy out up to maxEntries of the oldest published entries. Returns the number popped.
+	UINT32 Pop(_Out_writes_to_(maxEntries, return) T *pEntries, UINT32 maxEntries)
+	{
+		LONG head = m_Head;
+		UINT32 nPop = 0;
+
+		while (nPop < maxEntries && IsPublished(head + (LONG)nPop))
+		{
+			nPop++;
+		}
+
+		// Don't read entries before the sequences which published them.
+		MemoryBarrier();
+
+		for (UINT32 i = 0; i < nPop; i++)
+		{
+			pEntries[i] = m_Entries[(UINT32)(head + i) & (Capacity - 1)];
+		}
+
+		// Entries must be copied out before the producers may overwrite them.
+		MemoryBarrier();
+		m_Head = head + nPop;
+
+		return nPop;
+	}
+
+	// Entries reserved by the producers and not popped yet.
+	UINT32 GetOccupancy()
+	{
+		return (UINT32)(m_Tail - m_Head);
+	}
+
+	// TRUE if Pop() has nothing to take. Entries which are reserved but not published don't count,
+	// their producer wakes up the consumer once it's done.
+	BOOL IsEmpty()
+	{
+		return IsPublished(m_Head) ? FALSE : TRUE;
+	}
+};
@@ -0,0 +1,484 @@
+#include "internal.h"
+#if defined(EVENT_TRACING)
+#include "timer.tmh"
+#endif
+#include "Timer.h"
+
+CTimerWheel *CTimerWheel::s_pWheel = NULL;
+SRWLOCK CTimerWheel::s_WheelLock = SRWLOCK_INIT;
+
+//
+// Implementions of CWheelTimer.
+//
+CWheelTimer::CWheelTimer(PFN_WHEEL_TIMER_CALLBACK pfnCallback, void *pContext, _In_opt_ CTimerWheel *pWheel)
+{
+	m_pNext = NULL;
+	m_ppPrev = NULL;
+	m_Expiry = 0;
+	m_pfnCallback = pfnCallback;
+	m_pContext = pContext;
+	m_fSharedWheel = (pWheel == NULL) ? TRUE : FALSE;
+	m_pWheel = m_fSharedWheel ? CTimerWheel::Acquire() : pWheel;
+}
+
+CWheelTimer::~CWheelTimer()
+{
+	if (m_pWheel != NULL)
+	{
+		m_pWheel->StopTimer(this);
+		if (m_fSharedWheel)
+		{
+			CTimerWheel::Release();
+		}
+	}
+}
+
+void CWheelTimer::Start(UINT32 delay)
+{
+	if (m_pWheel != NULL)
+	{
+		m_pWheel->StartTimer(this, delay);
+	}
+}
+
+void CWheelTimer::Stop()
+{
+	if (m_pWheel != NULL)
+	{
+		m_pWheel->StopTimer(this);
+	}
+}
+
+BOOL CWheelTimer::IsArmed()
+{
+	return (m_pWheel != NULL) ? m_pWheel->IsArmed(this) : FALSE;
+}
+
+ULONGLONG CWheelTimer::GetTick()
+{
+	return (m_pWheel != NULL) ? m_pWheel->GetTick() : GetTickCount64();
+}
+
+ULONGLONG CWheelTimer::GetMicroseconds()
+{
+	return (m_pWheel != NULL) ? m_pWheel->GetMicroseconds() : GetTickCount64() * 1000;
+}
+
+//
+// Implementions of CTimerWheel.
+//
+CTimerWheel::CTimerWheel()
+{
+	InitializeCriticalSectionAndSpinCount(&m_Lock, 4000);
+	ZeroMemory(m_Slots, sizeof(m_Slots));
+	m_Now = 0;
+	m_NextWake = MAXULONGLONG;
+	m_nArmed = 0;
+	m_pRunning = NULL;
+	m_RunningThreadId = 0;
+	m_pClock = &m_SystemClock;
+	m_fStop = FALSE;
+	m_nFired = 0;
+	m_MaxLateUs = 0;
+	m_nRefs = 0;
+
+	// The high resolution timer isn't held to the system timer tick. Fall back to a regular one
+	// on systems which don't have it.
+	m_hWaitTimer = CreateWaitableTimerEx(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (m_hWaitTimer == NULL)
+	{
+		m_hWaitTimer = CreateWaitableTimer(NULL, FALSE, NULL);
+	}
+	m_hArmEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	m_Thread = CreateThread(0, 0, WheelThread, this, 0, 0);
+	if (m_Thread == NULL)
+	{
+		Trace(TRACE_LEVEL_ERROR, "CTimerWheel: Failed to create the wheel thread.\n");
+	}
+}
+
+CTimerWheel::CTimerWheel(_In_ CClock *pClock)
+{
+	InitializeCriticalSectionAndSpinCount(&m_Lock, 4000);
+	ZeroMemory(m_Slots, sizeof(m_Slots));
+	m_Now = pClock->GetTick();
+	m_NextWake = MAXULONGLONG;
+	m_nArmed = 0;
+	m_pRunning = NULL;
+	m_RunningThreadId = 0;
+	m_pClock = pClock;
+	m_fStop = FALSE;
+	m_nFired = 0;
+	m_MaxLateUs = 0;
+	m_nRefs = 0;
+
+	m_hWaitTimer = NULL;
+	m_hArmEvent = NULL;
+	m_Thread = NULL;
+}
+
+CTimerWheel::~CTimerWheel()
+{
+	if (m_Thread != NULL)
+	{
+		InterlockedExchange(&m_fStop, TRUE);
+		SetEvent(m_hArmEvent);
+		WaitForSingleObject(m_Thread, INFINITE);
+		CloseHandle(m_Thread);
+	}
+	if (m_hWaitTimer != NULL)
+	{
+		CloseHandle(m_hWaitTimer);
+	}
+	if (m_hArmEvent != NULL)
+	{
+		CloseHandle(m_hArmEvent);
+	}
+	DeleteCriticalSection(&m_Lock);
+}
+
+CTimerWheel *CTimerWheel::Acquire()
+{
+	CTimerWheel *pWheel;
+
+	AcquireSRWLockExclusive(&s_WheelLock);
+	if (s_pWheel == NULL)
+	{
+		s_pWheel = new CTimerWheel();
+	}
+	pWheel = s_pWheel;
+	if (pWheel != NULL)
+	{
+		pWheel->m_nRefs++;
+	}
+	ReleaseSRWLockExclusive(&s_WheelLock);
+
+	return pWheel;
+}
+
+CTimerWheel *CTimerWheel::Peek()
+{
+	CTimerWheel *pWheel;
+
+	AcquireSRWLockExclusive(&s_WheelLock);
+	pWheel = s_pWheel;
+	if (pWheel != NULL)
+	{
+		pWheel->m_nRefs++;
+	}
+	ReleaseSRWLockExclusive(&s_WheelLock);
+
+	return pWheel;
+}
+
+void CTimerWheel::Release()
+{
+	CTimerWheel *pWheel = NULL;
+
+	AcquireSRWLockExclusive(&s_WheelLock);
+	if (s_pWheel != NULL && --s_pWheel->m_nRefs == 0)
+	{
+		pWheel = s_pWheel;
+		s_pWheel = NULL;
+	}
+	ReleaseSRWLockExclusive(&s_WheelLock);
+
+	delete pWheel;
+}
+
+ULONGLONG CTimerWheel::GetTick()
+{
+	return m_pClock->GetTick();
+}
+
+ULONGLONG CTimerWheel::GetMicroseconds()
+{
+	return m_pClock->GetMicroseconds();
+}
+
+/*
+Put the timer into the slot of the lowest level whose range covers its expiry. The lock must be held.
+*/
+void CTimerWheel::Link(_Inout_ CWheelTimer *pTimer)
+{
+	ULONGLONG delta = pTimer->m_Expiry - m_Now;
+	UINT32 level = 0;
+	CWheelTimer **ppSlot;
+
+	while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1))))
+	{
+		level++;
+	}
+
+	// Farther than the top level reaches. Parked in the last slot, it gets cascaded again.
+	if (delta >= (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)))
+	{
+		ppSlot = &m_Slots[level][((m_Now >> (TIMER_WHEEL_BITS * level)) - 1) & (TIMER_WHEEL_SLOTS - 1)];
+	}
+	else
+	{
+		ppSlot = &m_Slots[level][(pTimer->m_Expiry >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+	}
+
+	pTimer->m_pNext = *ppSlot;
+	if (pTimer->m_pNext != NULL)
+	{
+		pTimer->m_pNext->m_ppPrev = &pTimer->m_pNext;
+	}
+	pTimer->m_ppPrev = ppSlot;
+	*ppSlot = pTimer;
+}
+
+void CTimerWheel::Unlink(_Inout_ CWheelTimer *pTimer)
+{
+	*pTimer->m_ppPrev = pTimer->m_pNext;
+	if (pTimer->m_pNext != NULL)
+	{
+		pTimer->m_pNext->m_ppPrev = pTimer->m_ppPrev;
+	}
+	pTimer->m_pNext = NULL;
+	pTimer->m_ppPrev = NULL;
+}
+
+void CTimerWheel::StartTimer(_Inout_ CWheelTimer *pTimer, UINT32 delay)
+{
+	ULONGLONG expiry = GetTick() + delay;
+	BOOL fWake = FALSE;
+
+	EnterCriticalSection(&m_Lock);
+
+	if (pTimer->m_ppPrev != NULL)
+	{
+		Unlink(pTimer);
+		m_nArmed--;
+	}
+
+	// The slot of m_Now was already run, so the earliest tick left is the next one.
+	pTimer->m_Expiry = (expiry > m_Now) ? expiry : m_Now + 1;
+	Link(pTimer);
+	m_nArmed++;
+
+	if (pTimer->m_Expiry < m_NextWake)
+	{
+		m_NextWake = pTimer->m_Expiry;
+		fWake = TRUE;
+	}
+
+	LeaveCriticalSection(&m_Lock);
+
+	if (fWake && m_hArmEvent != NULL)
+	{
+		SetEvent(m_hArmEvent);
+	}
+}
+
+/*
+Disarm the timer. When this returns, its callback isn't running any more, unless Stop()
+was called by the callback itself.
+*/
+void CTimerWheel::StopTimer(_Inout_ CWheelTimer *pTimer)
+{
+	EnterCriticalSection(&m_Lock);
+
+	if (pTimer->m_ppPrev != NULL)
+	{
+		Unlink(pTimer);
+		m_nArmed--;
+	}
+
+	while (m_pRunning == pTimer && GetCurrentThreadId() != m_RunningThreadId)
+	{
+		LeaveCriticalSection(&m_Lock);
+		SwitchToThread();
+		EnterCriticalSection(&m_Lock);
+	}
+
+	LeaveCriticalSection(&m_Lock);
+}
+
+BOOL CTimerWheel::IsArmed(_In_ CWheelTimer *pTimer)
+{
+	BOOL fArmed;
+
+	EnterCriticalSection(&m_Lock);
+	fArmed = (pTimer->m_ppPrev != NULL) ? TRUE : FALSE;
+	LeaveCriticalSection(&m_Lock);
+
+	return fArmed;
+}
+
+/*
+Move the timers of one slot of an upper level down to the levels below. The lock must be held.
+*/
+void CTimerWheel::Cascade(UINT32 level, ULONGLONG tick)
+{
+	CWheelTimer **ppSlot = &m_Slots[level][(tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+	CWheelTimer *pTimer = *ppSlot;
+
+	*ppSlot = NULL;
+	while (pTimer != NULL)
+	{
+		CWheelTimer *pNext = pTimer->m_pNext;
+
+		Link(pTimer);
+		pTimer = pNext;
+	}
+}
+
+/*
+Run all the timers which expire up to the tick. The lock must be held. It's left while a
+callback runs, so that the callback may start and stop timers.
+*/
+void CTimerWheel::Advance(ULONGLONG tick)
+{
+	if (m_nArmed == 0)
+	{
+		m_Now = tick;
+		return;
+	}
+
+	while (m_Now < tick)
+	{
+		CWheelTimer **ppSlot;
+		UINT32 level = 0;
+
+		m_Now++;
+
+		// A wrap of a level pulls the next slot of the level above down. The highest level
+		// goes first, so that its timers may still land in the slots cascaded after it.
+		while (level < TIMER_WHEEL_LEVELS - 1 && (m_Now & ((1ULL << (TIMER_WHEEL_BITS * (level + 1))) - 1)) == 0)
+		{
+			level++;
+		}
+		for (; level > 0; level--)
+		{
+			Cascade(level, m_Now);
+		}
+
+		ppSlot = &m_Slots[0][m_Now & (TIMER_WHEEL_SLOTS - 1)];
+		while (*ppSlot != NULL)
+		{
+			CWheelTimer *pTimer = *ppSlot;
+			PFN_WHEEL_TIMER_CALLBACK pfnCallback = pTimer->m_pfnCallback;
+			void *pContext = pTimer->m_pContext;
+			ULONGLONG expiryUs = pTimer->m_Expiry * 1000;
+			ULONGLONG nowUs;
+
+			Unlink(pTimer);
+			m_nArmed--;
+			m_pRunning = pTimer;
+			m_RunningThreadId = GetCurrentThreadId();
+
+			LeaveCriticalSection(&m_Lock);
+
+			nowUs = GetMicroseconds();
+			if (nowUs > expiryUs && (LONG)(nowUs - expiryUs) > m_MaxLateUs)
+			{
+				m_MaxLateUs = (LONG)(nowUs - expiryUs);
+			}
+			InterlockedIncrement(&m_nFired);
+
+			(*pfnCallback)(pContext);
+
+			EnterCriticalSection(&m_Lock);
+			m_pRunning = NULL;
+		}
+	}
+}
+
+/*
+Earliest tick which has to be run. The level 0 slots are looked up directly. Timers of the
+upper levels are only known to be due after the next wrap of level 0, which cascades them.
+*/
+ULONGLONG CTimerWheel::GetNextExpiry()
+{
+	ULONGLONG tick;
+
+	if (m_nArmed == 0)
+	{
+		return MAXULONGLONG;
+	}
+
+	for (tick = m_Now + 1; ; tick++)
+	{
+		if (m_Slots[0][tick & (TIMER_WHEEL_SLOTS - 1)] != NULL)
+		{
+			return tick;
+		}
+		if ((tick & (TIMER_WHEEL_SLOTS - 1)) == 0)
+		{
+			return tick;	// Cascade point.
+		}
+	}
+}
+
+ULONGLONG CTimerWheel::GetNextDueTick()
+{
+	ULONGLONG tick;
+
+	EnterCriticalSection(&m_Lock);
+	tick = GetNextExpiry();
+	LeaveCriticalSection(&m_Lock);
+
+	return tick;
+}
+
+void CTimerWheel::RunDueTimers()
+{
+	if (m_Thread != NULL)
+	{
+		Trace(TRACE_LEVEL_ERROR, "RunDueTimers: The wheel thread runs the timers.\n");
+		return;
+	}
+
+	EnterCriticalSection(&m_Lock);
+	Advance(GetTick());
+	LeaveCriticalSection(&m_Lock);
+}
+
+DWORD WINAPI CTimerWheel::WheelThread(LPVOID lpParam)
+{
+	CTimerWheel *This = (CTimerWheel *)lpParam;
+
+	Trace(TRACE_LEVEL_INFORMATION, "WheelThread started...\n");
+
+	This->DoWheelLoop();
+
+	return 0;
+}
+
+void CTimerWheel::DoWheelLoop()
+{
+	while (m_fStop == FALSE)
+	{
+		ULONGLONG nextWake;
+
+		EnterCriticalSection(&m_Lock);
+		Advance(GetTick());
+		nextWake = GetNextExpiry();
+		m_NextWake = nextWake;
+		LeaveCriticalSection(&m_Lock);
+
+		if (nextWake == MAXULONGLONG)
+		{
+			WaitForSingleObject(m_hArmEvent, INFINITE);
+		}
+		else
+		{
+			HANDLE handles[2] = { m_hArmEvent, m_hWaitTimer };
+			ULONGLONG nowUs = GetMicroseconds();
+			LARGE_INTEGER dueTime;
+
+			if (nextWake * 1000 <= nowUs)
+			{
+				continue;
+			}
+
+			// Relative due time in 100 ns units.
+			dueTime.QuadPart = -(LONGLONG)((nextWake * 1000 - nowUs) * 10);
+			SetWaitableTimer(m_hWaitTimer, &dueTime, 0, NULL, NULL, FALSE);
+			WaitForMultipleObjects(ARRAY_SIZE(handles), handles, FALSE, INFINITE);
+		}
+	}
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Clock.h"
+
+//
+// Hierarchical timer wheel. One wheel on the system clock is shared by all the gesture engines
+// of the process. A wheel on a clock of its own, such as a CVirtualClock, serves one engine
+// which replays touch traffic.
+//
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION	0x00000002
+#endif
+
+#define TIMER_WHEEL_BITS	8
+#define TIMER_WHEEL_SLOTS	(1 << TIMER_WHEEL_BITS)	// Slots per level.
+#define TIMER_WHEEL_LEVELS	3		// 1 ms, 256 ms and 65.5 s per slot. Covers about 4.6 hours.
+
+typedef void (*PFN_WHEEL_TIMER_CALLBACK)(void *pContext);
+
+class CTimerWheel;
+
+//
+// One timer of the wheel. Start(), Stop() and restarting are O(1) and may be called on any
+// thread. The callback runs on the wheel thread, so it must be short. It may still run once
+// right after Stop() if it already fired, which the callee has to tolerate.
+//
+class CWheelTimer
+{
+	friend class CTimerWheel;
+
+private:
+	CWheelTimer	*m_pNext;		// Next timer of the same slot.
+	CWheelTimer	**m_ppPrev;		// Link which points to this timer. NULL if not armed.
+	ULONGLONG	m_Expiry;		// Wheel tick when the timer fires.
+
+	PFN_WHEEL_TIMER_CALLBACK m_pfnCallback;
+	void		*m_pContext;
+	CTimerWheel	*m_pWheel;
+	BOOL		m_fSharedWheel;	// m_pWheel was acquired and must be released.
+
+public:
+	// The timer runs on pWheel, or on the shared wheel if pWheel is NULL.
+	CWheelTimer(PFN_WHEEL_TIMER_CALLBACK pfnCallback, void *pContext, _In_opt_ CTimerWheel *pWheel = NULL);
+	~CWheelTimer();
+
+	void Start(UINT32 delay);	// delay : milliseconds from now. Restarts the timer if it's armed.
+	void Stop();
+	BOOL IsArmed();
+	ULONGLONG GetTick();		// Milliseconds of the wheel clock.
+	ULONGLONG GetMicroseconds();	// Microseconds of the wheel clock.
+};
+
+class CTimerWheel
+{
+private:
+	CRITICAL_SECTION	m_Lock;
+	CWheelTimer	*m_Slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	ULONGLONG	m_Now;			// Last tick whose timers were run.
+	ULONGLONG	m_NextWake;		// Tick the wheel thread sleeps until. MAXULONGLONG if idle.
+	UINT32		m_nArmed;
+	CWheelTimer	*m_pRunning;	// Timer whose callback is running.
+	DWORD		m_RunningThreadId;	// Thread which runs the callback of m_pRunning.
+
+	CClock		*m_pClock;
+	CSystemClock	m_SystemClock;
+
+	HANDLE		m_Thread;
+	HANDLE		m_hWaitTimer;	// High resolution waitable timer to sleep on.
+	HANDLE		m_hArmEvent;	// Wakes up the wheel thread when an earlier timer is armed.
+	volatile LONG m_fStop;
+
+	LONG		m_nRefs;
+	static CTimerWheel	*s_pWheel;
+	static SRWLOCK		s_WheelLock;
+
+	CTimerWheel();			// Shared wheel on the system clock.
+
+	void Link(_Inout_ CWheelTimer *pTimer);
+	void Unlink(_Inout_ CWheelTimer *pTimer);
+	void Cascade(UINT32 level, ULONGLONG tick);
+	void Advance(ULONGLONG tick);
+	ULONGLONG GetNextExpiry();
+
+	static DWORD WINAPI WheelThread(LPVOID lpParam);
+	void DoWheelLoop();
+
+public:
+	volatile LONG	m_nFired;			// Timers which fired.
+	volatile LONG	m_MaxLateUs;		// Latest firing seen, in microseconds after the expiry.
+
+public:
+	// Wheel without a thread on pClock. Its timers only run in RunDueTimers().
+	CTimerWheel(_In_ CClock *pClock);
+	~CTimerWheel();
+
+	// The shared wheel is created by the first user and destroyed with the last one.
+	static CTimerWheel *Acquire();
+	static CTimerWheel *Peek();		// Like Acquire(), but NULL instead of creating the wheel.
+	static void Release();
+
+	ULONGLONG GetTick();			// Milliseconds of the wheel clock.
+	ULONGLONG GetMicroseconds();
+
+	void StartTimer(_Inout_ CWheelTimer *pTimer, UINT32 delay);
+	void StopTimer(_Inout_ CWheelTimer *pTimer);
+	BOOL IsArmed(_In_ CWheelTimer *pTimer);
+
+	// Stepping of a wheel without a thread. A replay moves its clock to each due tick in turn
+	// and runs the timers there, so that every callback sees the time of its own expiry.
+	ULONGLONG GetNextDueTick();		// Tick to run next. MAXULONGLONG if no timer is armed.
+	void RunDueTimers();			// Run the timers due by the time of the clock.
+};
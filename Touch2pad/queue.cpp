@@ -574,26 +574,6 @@ CMyQueue::ReadReport(
     )
 {
     HRESULT hr;
-    PTP_TIMER timer = NULL;
-
-    //
-    // start the timer if not already started
-    //
-    timer = m_Device->m_ManualQueue->GetTimer();
-    if (IsThreadpoolTimerSet(timer) == FALSE) 
-    {     
-        FILETIME dueTime;
-        Trace(TRACE_LEVEL_INFORMATION, "*** Setting the timer ***\n");
-
-        *reinterpret_cast<PLONGLONG>(&dueTime) = 
-            -static_cast<LONGLONG>(MILLI_SECOND_TO_NANO100(1000));
-        
-        SetThreadpoolTimer(timer,
-                           &dueTime,
-                           5000,  // ms periodic
-                           0      // optional delay in ms
-                           );
-    }
 
     //
     // forward the request to manual queue
@@ -606,6 +586,11 @@ CMyQueue::ReadReport(
     }
     else {
         *CompleteRequest = FALSE;
+
+        //
+        // complete it right away if mouse events are waiting for a read request
+        //
+        m_Device->m_ManualQueue->OnReadRequestQueued();
     }
 
     return hr;
@@ -1497,6 +1482,17 @@ CMyManualQueue::Initialize(
 		FxDevice->GetDefaultIoTarget(&m_FxIoTarget);
 	}
 
+	// Preallocate the requests for reading touch reports before the interrupt thread starts.
+	if (SUCCEEDED(hr))
+	{
+		hr = CreateRequestPool(FxDevice);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		ReadIoDepthBounds(FxDevice);
+	}
+
 	if (SUCCEEDED(hr))
     {
         //
@@ -1511,11 +1507,107 @@ CMyManualQueue::Initialize(
             Trace(TRACE_LEVEL_ERROR, 
                 "Failed to allocate timer %!hresult!", hr);
         }
-		m_InterruptThread = CreateThread(0, 0, InterruptThread, this, 0, 0);
     }
 
 	m_pGesture = new CGesture();
 	m_pGesture->SetEventCallback((void*)this, OnGestureEvent);
+	m_pGesture->SetPostCallback((void*)this, OnGesturePost);
+	m_FrameAssembler.SetFrameCallback((void*)this, OnTouchFrame);
+
+	// The gesture engine must exist before any report can complete.
+	if (SUCCEEDED(hr))
+	{
+		m_GestureThread = CreateThread(0, 0, GestureThread, this, 0, 0);
+		m_InterruptThread = CreateThread(0, 0, InterruptThread, this, 0, 0);
+	}
+
+	// The timer retries the failed reads, so it runs from the start.
+	if (SUCCEEDED(hr))
+	{
+		FILETIME dueTime;
+
+		*reinterpret_cast<PLONGLONG>(&dueTime) =
+			-static_cast<LONGLONG>(MILLI_SECOND_TO_NANO100(IO_TIMER_PERIOD_MS));
+
+		SetThreadpoolTimer(m_Timer, &dueTime, IO_TIMER_PERIOD_MS, 0);
+	}
+
+    return hr;
+}
+
+HRESULT
+CMyManualQueue::CreateRequestPool(
+    _In_ IWDFDevice *FxDevice
+    )
+/*++
+ 
+  Routine Description:
+
+    This method creates all the requests and output buffers which are used
+    for IOCTL_SELFTEST_GET_INPUT_REPORT. They are recycled on completion so
+    that the touch read path doesn't allocate in steady state.
+
+  Arguments:
+
+    FxDevice - the device which this Queue is for.
+
+  Return Value:
+
+    status.
+
+--*/
+{
+    IWDFDriver *FxDriver = m_Device->GetFxDriver();
+    HRESULT hr = S_OK;
+
+    for (int i = 0; i < MAX_IO_REQUEST; i++)
+    {
+        PTOUCH_IO_SLOT pSlot = &m_IoSlots[i];
+        CComPtr<IWDFIoRequest> pIoRequest;
+        CComPtr<IWDFMemory> pOutputMemory;
+
+        hr = FxDevice->CreateRequest(
+            NULL,
+            NULL,
+            &pIoRequest
+            );
+        if (FAILED(hr))
+        {
+            Trace(TRACE_LEVEL_ERROR, "Error in CreateRequestPool - CreateRequest. hr=0x%x\n", hr);
+            break;
+        }
+        InterlockedIncrement(&m_nFxAllocations);
+
+        // Big enough for either IOCTL_SELFTEST_GET_INPUT_REPORT or its batched variant.
+        hr = FxDriver->CreateWdfMemory(sizeof(HID_TOUCH_REPORT_BATCH),
+            NULL,
+            pIoRequest,		// Set IoRequest as the parent to be freed when IoRequest is deleted.
+            &pOutputMemory);
+        if (FAILED(hr))
+        {
+            Trace(TRACE_LEVEL_ERROR, "Error in CreateRequestPool - CreateWdfMemory. hr=0x%x\n", hr);
+            break;
+        }
+        InterlockedIncrement(&m_nFxAllocations);
+
+        hr = pIoRequest->QueryInterface(IID_PPV_ARGS(&pSlot->pFxRequest));
+        if (FAILED(hr))
+        {
+            Trace(TRACE_LEVEL_ERROR, "Error in CreateRequestPool - QueryInterface. hr=0x%x\n", hr);
+            break;
+        }
+
+        //
+        // Keep weak references only. The request is parented to the device and
+        // the memory to the request, so the framework frees both together.
+        //
+        pSlot->pFxRequest->Release();
+        pSlot->pFxMemory = pOutputMemory;
+
+        InterlockedPushEntrySList(&m_FreeSlots, &pSlot->ListEntry);
+    }
+
+    Trace(TRACE_LEVEL_INFORMATION, "CreateRequestPool: %d requests preallocated.\n", QueryDepthSList(&m_FreeSlots));
 
     return hr;
 }
@@ -1538,16 +1630,73 @@ _In_ void *Context                         /* Context */
 
 	if (CompletionParams->GetCompletedRequestType() == WdfRequestDeviceIoControl)
 	{
-		IWDFMemory *FxOutputMemory;
-		FxOutputMemory = (IWDFMemory *)Context;
+		PTOUCH_IO_SLOT pSlot = (PTOUCH_IO_SLOT)Context;
+		HRESULT hrStatus = CompletionParams->GetCompletionStatus();
+		ULONG_PTR information = CompletionParams->GetInformation();
+		BOOL fRearm = SUCCEEDED(hrStatus);
+		LARGE_INTEGER completeTime;
+
+		CompletionParams->Release();
+
+		QueryPerformanceCounter(&completeTime);
+		m_IoDepthController.OnCompletion(pSlot->SendTime, completeTime.QuadPart);
+
+		if (SUCCEEDED(hrStatus))
+		{
+			ProcessTouchReports(pSlot, information);
+		}
+		else if (pSlot->IoctlCode == IOCTL_SELFTEST_GET_INPUT_REPORT_BATCH &&
+			(hrStatus == HRESULT_FROM_NT(STATUS_INVALID_DEVICE_REQUEST) ||
+			 hrStatus == HRESULT_FROM_NT(STATUS_NOT_SUPPORTED) ||
+			 hrStatus == HRESULT_FROM_WIN32(ERROR_INVALID_FUNCTION)))
+		{
+			// The lower device doesn't know the batched IOCTL. Fall back to one report per request.
+			if (InterlockedExchange(&m_fBatchIo, FALSE) != FALSE)
+			{
+				Trace(TRACE_LEVEL_INFORMATION, "IOCTL_SELFTEST_GET_INPUT_REPORT_BATCH not supported. Using single reports.\n");
+			}
+			fRearm = TRUE;
+		}
+		else if (IsReadFatal(hrStatus))
+		{
+			Trace(TRACE_LEVEL_INFORMATION, "IOCTL_SELFTEST_GET_INPUT_REPORT stopped. hr=0x%x\n", hrStatus);
+		}
+		else
+		{
+			Trace(TRACE_LEVEL_ERROR, "IOCTL_SELFTEST_GET_INPUT_REPORT failed. hr=0x%x\n", hrStatus);
+			InterlockedExchange(&m_fReadRetry, TRUE);
+		}
 
-		m_pGesture->InjectTouchPoint((HID_TOUCH_REPORT *)FxOutputMemory->GetDataBuffer(NULL));
+		// Recycle the request and its output memory instead of deleting them.
+		pSlot->pFxRequest->Reuse(S_OK);
 
-		// Release the request and free output memory.
-		FxRequest->DeleteWdfObject();
+#if RESUBMIT_ON_COMPLETION
+		// Re-arm the same request straight away so that the read depth stays constant.
+		// A failed request is not re-armed, otherwise a removed target would make us spin.
+		// _TimerCallback retries it later unless the target is gone.
+		if (fRearm)
+		{
+			if (m_IoCredit.Retire())
+			{	// The depth was lowered. Park this request in the pool instead of re-arming it.
+				InterlockedPushEntrySList(&m_FreeSlots, &pSlot->ListEntry);
+				return;
+			}
+
+			if (SUCCEEDED(SendTouchRequest(pSlot)))
+			{
+				return;
+			}
+
+			Trace(TRACE_LEVEL_ERROR, "Error in re-sending IOCTL_SELFTEST_GET_INPUT_REPORT.\n");
+			pSlot->pFxRequest->Reuse(S_OK);
+			InterlockedExchange(&m_fReadRetry, TRUE);
+		}
+#endif
 
-		m_nIoRequests--;
-		SetEvent(m_hCompletionEvent);
+		// The slot must be back in the pool before its credit is released.
+		InterlockedPushEntrySList(&m_FreeSlots, &pSlot->ListEntry);
+		m_IoCredit.Release();
+		return;
 	}
 
 	CompletionParams->Release();
@@ -1572,7 +1721,22 @@ CMyManualQueue::_TimerCallback(
     UNREFERENCED_PARAMETER(Instance);
     UNREFERENCED_PARAMETER(Timer);
 
-    Trace(TRACE_LEVEL_ERROR, "_TimerCallback CMyQueue 0x%p\n", This);
+	This->UpdateIoDepth();
+
+#if RESUBMIT_ON_COMPLETION
+	// Send the reads which failed since the last call again.
+	if (!This->m_fTargetGone && !This->m_fStopIo && InterlockedExchange(&This->m_fReadRetry, FALSE))
+	{
+		This->ArmPooledRequests();
+	}
+#endif
+
+	if (InterlockedIncrement(&This->m_nTimerTicks) % (IO_STATS_PERIOD_MS / IO_TIMER_PERIOD_MS) == 0)
+	{
+		Trace(TRACE_LEVEL_ERROR, "_TimerCallback CMyQueue 0x%p\n", This);
+
+		This->ReportIoStatistics();
+	}
 
 #if 0
     //
@@ -1641,6 +1805,8 @@ CMyManualQueue::OnCleanup(
     )
 {
     UNREFERENCED_PARAMETER(pWdfObject);
+
+	InterlockedExchange(&m_fStopIo, TRUE);
     
     if (m_Timer != NULL) {
         //
@@ -1668,6 +1834,15 @@ CMyManualQueue::OnCleanup(
 
         m_Timer = NULL;
 
+		if (NULL != m_GestureThread)
+		{
+			InterlockedExchange(&m_fStopGesture, TRUE);
+			SetEvent(m_hGestureEvent);
+			WaitForSingleObject(m_GestureThread, INFINITE);
+			CloseHandle(m_GestureThread);
+			m_GestureThread = NULL;
+		}
+
 		if (NULL != m_InterruptThread)
 			CloseHandle(m_InterruptThread);
 
@@ -1694,6 +1869,11 @@ BOOL CMyManualQueue::DoMainIo()
 
 	BlockTouch(m_PointingMode ? TRUE:FALSE);	// Request to block multi-touch.
 
+#if RESUBMIT_ON_COMPLETION
+	// Only prime the pipeline. OnCompletion() keeps every request in flight from now on,
+	// so this thread exits instead of polling.
+	ArmPooledRequests();
+#else
 	for (;;)
 	{
 		if (FALSE == ProcessRawTouch())
@@ -1701,6 +1881,7 @@ BOOL CMyManualQueue::DoMainIo()
 			break;
 		}
 	}
+#endif
 
 	Trace(TRACE_LEVEL_INFORMATION, "DoMainIo()---\n");
 	return TRUE;
@@ -1712,71 +1893,468 @@ This is called in the main thread context of the driver.
 BOOL CMyManualQueue::ProcessRawTouch()
 {
 	HRESULT hr;
-	IWDFDriver *FxDriver;
-	IWDFDevice *FxDevice;
-	CComPtr<IWDFIoRequest>      pIoRequest;
+	PTOUCH_IO_SLOT pSlot;
 
 	Trace(TRACE_LEVEL_INFORMATION, "ProcessRawTouch()+++\n");
-	FxDriver = m_Device->GetFxDriver();
-	FxDevice = m_Device->GetFxDevice();
 
-	if (m_nIoRequests >= MAX_IO_REQUEST)
+	// Wait for any request to be completed if maximum requests are made.
+	m_IoCredit.Acquire();
+
+	pSlot = (PTOUCH_IO_SLOT)InterlockedPopEntrySList(&m_FreeSlots);
+	if (NULL == pSlot)
 	{
-		Trace(TRACE_LEVEL_INFORMATION, "m_nIoRequests reached the maximum(%d). Now hold.\n", m_nIoRequests);
-		// If maximum requests are maded, wait for any request to be completed.
-		WaitForSingleObject(m_hCompletionEvent, INFINITE);
-		Trace(TRACE_LEVEL_INFORMATION, "m_nIoRequests=%d\n", m_nIoRequests);
+		// Can't happen as long as every credit has its slot in the pool.
+		Trace(TRACE_LEVEL_ERROR, "No free request in the pool.\n");
+		m_IoCredit.Release();
+		return FALSE;
 	}
 
-	hr = FxDevice->CreateRequest(
-		NULL,
-		NULL,
-		&pIoRequest
-		);
+	// Mark that the request has been sent, so we don't try to send 
+	// again before the completion routine runs.
+	m_IoctlInProgress = true;
 
+	hr = SendTouchRequest(pSlot);
 	if (FAILED(hr))
 	{
-		Trace(TRACE_LEVEL_ERROR, "Error in CMyRemoteTarget::CreateRequest. hr=0x%x\n", hr);
+		Trace(TRACE_LEVEL_ERROR, "Error in Sending IOCTL_SELFTEST_GET_INPUT_REPORT.\n");
+		pSlot->pFxRequest->Reuse(S_OK);
+		InterlockedPushEntrySList(&m_FreeSlots, &pSlot->ListEntry);
+		m_IoCredit.Release();
+		m_IoctlInProgress = false;
 		return FALSE;
 	}
 
-	// Create a buffer for the read request
+	Trace(TRACE_LEVEL_INFORMATION, "ProcessRawTouch()---\n");
+	return TRUE;
+}
 
-	CComPtr<IWDFMemory> pOutputMemory;
-	hr = FxDriver->CreateWdfMemory(sizeof(HID_TOUCH_REPORT),
-		NULL,
-		pIoRequest,		// Set IoRequest as the parent to be freed when IoRequest is deleted.
-		&pOutputMemory);
+/*
+Hand the reports of a completed request to the gesture engine in one pass.
+Information is the number of bytes the lower device returned.
+*/
+void CMyManualQueue::ProcessTouchReports(_In_ PTOUCH_IO_SLOT pSlot, _In_ ULONG_PTR Information)
+{
+	PVOID buffer = pSlot->pFxMemory->GetDataBuffer(NULL);
+	PHID_TOUCH_REPORT pReports;
+	UINT32 nReports;
+	int bucket;
 
-	// Mark that the request has been sent, so we don't try to send 
-	// again before the completion routine runs.
-	m_IoctlInProgress = true;
+	if (pSlot->IoctlCode == IOCTL_SELFTEST_GET_INPUT_REPORT_BATCH)
+	{
+		PHID_TOUCH_REPORT_BATCH pBatch = (PHID_TOUCH_REPORT_BATCH)buffer;
+
+		if (Information < FIELD_OFFSET(HID_TOUCH_REPORT_BATCH, Reports))
+		{
+			Trace(TRACE_LEVEL_ERROR, "Batch of %Iu bytes is too short.\n", Information);
+			return;
+		}
+
+		// Trust neither the count nor the byte count alone.
+		nReports = pBatch->nReports;
+		if (nReports > MAX_TOUCH_REPORT_BATCH)
+		{
+			nReports = MAX_TOUCH_REPORT_BATCH;
+		}
+		if (nReports > (Information - FIELD_OFFSET(HID_TOUCH_REPORT_BATCH, Reports)) / sizeof(HID_TOUCH_REPORT))
+		{
+			nReports = (UINT32)((Information - FIELD_OFFSET(HID_TOUCH_REPORT_BATCH, Reports)) / sizeof(HID_TOUCH_REPORT));
+		}
+		pReports = pBatch->Reports;
+	}
+	else
+	{
+		if (Information < sizeof(HID_TOUCH_REPORT))
+		{
+			Trace(TRACE_LEVEL_ERROR, "Report of %Iu bytes is too short.\n", Information);
+			return;
+		}
+
+		nReports = 1;
+		pReports = (PHID_TOUCH_REPORT)buffer;
+	}
+
+	if (nReports == 0)
+	{
+		return;
+	}
+
+	// Bucket index is ceil(log2(nReports)): 1, 2, 3-4, 5-8, 9-16, 17-32.
+	for (bucket = 0; bucket < TOUCH_BATCH_BUCKETS - 1 && (1U << bucket) < nReports; bucket++);
+	InterlockedIncrement(&m_BatchHistogram[bucket]);
+
+	// Only copy the reports. The gesture thread does the rest.
+	m_TouchRing.Push(pReports, nReports);
+
+	WakeGestureThread();
+}
+
+/*
+Signal the gesture thread only if it announced that it's going to sleep.
+*/
+void CMyManualQueue::WakeGestureThread()
+{
+	if (InterlockedExchange(&m_fGestureWaiting, FALSE) != FALSE)
+	{
+		SetEvent(m_hGestureEvent);
+	}
+}
+
+DWORD WINAPI CMyManualQueue::GestureThread( LPVOID lpParam )
+{
+	PCMyManualQueue This = (CMyManualQueue *)lpParam;
 
-	hr = m_FxIoTarget->FormatRequestForIoctl(pIoRequest,
-		(ULONG)IOCTL_SELFTEST_GET_INPUT_REPORT,
+	Trace(TRACE_LEVEL_INFORMATION, "GestureThread started...\n");
+	This->DoGestureLoop();
+
+	return 0;
+}
+
+/*
+Consumer of m_TouchRing and of the work posted by the gesture timers. This is the only thread
+which touches m_pGesture, so the touch frames, the tap timeouts, the synthesized clicks and
+the pointing mode toggle are serialized without any lock. The completion threads are never
+held by gesture processing.
+*/
+void CMyManualQueue::DoGestureLoop()
+{
+	HID_TOUCH_REPORT reports[MAX_TOUCH_REPORT_BATCH];
+	UINT32 nReports;
+	LONG work;
+	LARGE_INTEGER now;
+
+	while (m_fStopGesture == FALSE)
+	{
+		// Timer work first. A timeout which expired before the next frame arrived is
+		// then evaluated before that frame, as it was due earlier.
+		work = InterlockedExchange(&m_GestureWork, 0);
+		if (work != 0)
+		{
+			m_pGesture->RunPostedWork(work);
+		}
+
+		nReports = m_TouchRing.Pop(reports, ARRAY_SIZE(reports));
+
+		QueryPerformanceCounter(&now);
+		DeliverTouchReports(reports, nReports, now.QuadPart);
+
+		if (nReports != 0 || work != 0)
+		{
+			continue;
+		}
+
+		// Announce the sleep before the last look at the ring and the posted work, so that
+		// a producer which pushes in between is sure to signal the event.
+		InterlockedExchange(&m_fGestureWaiting, TRUE);
+		if (m_TouchRing.IsEmpty() && m_GestureWork == 0 && m_fStopGesture == FALSE)
+		{
+			WaitForGestureWork(now.QuadPart);
+		}
+		InterlockedExchange(&m_fGestureWaiting, FALSE);
+	}
+}
+
+/*
+Pass the reports through the reorder buffer and the frame assembler. Complete frames go to the
+gesture engine. Reports and frames which waited long enough are released even if nReports is 0.
+Called on the gesture thread only.
+*/
+void CMyManualQueue::DeliverTouchReports(_In_reads_(nReports) PHID_TOUCH_REPORT pReports, UINT32 nReports, LONGLONG now)
+{
+	HID_TOUCH_REPORT ordered[REORDER_CAPACITY];
+	UINT32 nOrdered;
+
+	for (UINT32 i = 0; i <= nReports; i++)
+	{
+		if (i < nReports)
+		{
+			m_ReorderBuffer.Insert(&pReports[i], now);
+		}
+
+		nOrdered = m_ReorderBuffer.Release(now, ordered, ARRAY_SIZE(ordered));
+		for (UINT32 j = 0; j < nOrdered; j++)
+		{
+			m_FrameAssembler.Add(&ordered[j], now);
+		}
+	}
+
+	m_FrameAssembler.Flush(now);
+}
+
+/*
+QueryPerformanceCounter() value when the report or frame which is held the longest is due.
+0 if none is held.
+*/
+LONGLONG CMyManualQueue::GetIngressDeadline()
+{
+	LONGLONG deadline = m_ReorderBuffer.NextDeadline();
+	LONGLONG frameDeadline = m_FrameAssembler.NextDeadline();
+
+	if (deadline == 0 || (frameDeadline != 0 && frameDeadline < deadline))
+	{
+		deadline = frameDeadline;
+	}
+
+	return deadline;
+}
+
+/*
+Sleep until m_hGestureEvent is signaled or the next ingress deadline passes. The deadlines are
+a few ms, so they are waited on m_hIngressTimer rather than with a millisecond timeout, which
+the system timer tick could stretch by up to 15 ms.
+*/
+void CMyManualQueue::WaitForGestureWork(LONGLONG now)
+{
+	LONGLONG deadline = GetIngressDeadline();
+	HANDLE handles[] = { m_hGestureEvent, m_hIngressTimer };
+	LARGE_INTEGER dueTime;
+
+	if (deadline == 0)
+	{
+		WaitForSingleObject(m_hGestureEvent, INFINITE);
+		return;
+	}
+
+	if (deadline <= now)
+	{
+		return;
+	}
+
+	// Relative due time in 100 ns units. Round up so that the deadline has passed when we wake up.
+	dueTime.QuadPart = -(((deadline - now) * 10000000 + m_QpcFrequency - 1) / m_QpcFrequency);
+	SetWaitableTimer(m_hIngressTimer, &dueTime, 0, NULL, NULL, FALSE);
+
+	if (WaitForMultipleObjects(ARRAY_SIZE(handles), handles, FALSE, INFINITE) == WAIT_OBJECT_0)
+	{	// Woken up before the deadline. Don't let the timer wake up the next wait.
+		CancelWaitableTimer(m_hIngressTimer);
+	}
+}
+
+/*
+Format a pooled request for IOCTL_SELFTEST_GET_INPUT_REPORT, or its batched variant while the
+lower device supports it, and send it to the lower device.
+The request must have been reused (or be freshly created) before this is called.
+*/
+HRESULT CMyManualQueue::SendTouchRequest(_In_ PTOUCH_IO_SLOT pSlot)
+{
+	HRESULT hr;
+
+	WDFMEMORY_OFFSET outputOffset;
+
+	if (m_fBatchIo)
+	{
+		pSlot->IoctlCode = IOCTL_SELFTEST_GET_INPUT_REPORT_BATCH;
+		outputOffset.BufferOffset = 0;
+		outputOffset.BufferLength = sizeof(HID_TOUCH_REPORT_BATCH);
+	}
+	else
+	{
+		pSlot->IoctlCode = IOCTL_SELFTEST_GET_INPUT_REPORT;
+		outputOffset.BufferOffset = 0;
+		outputOffset.BufferLength = sizeof(HID_TOUCH_REPORT);
+	}
+
+	hr = m_FxIoTarget->FormatRequestForIoctl(pSlot->pFxRequest,
+		pSlot->IoctlCode,
 		NULL,
 		NULL,
 		NULL,
-		pOutputMemory,
-		NULL
+		pSlot->pFxMemory,
+		&outputOffset
 		);
 
 	if (SUCCEEDED(hr))
 	{
-		pIoRequest->SetCompletionCallback(this, (void *)pOutputMemory);
+		LARGE_INTEGER sendTime;
+
+		pSlot->pFxRequest->SetCompletionCallback(this, (void *)pSlot);
+
+		QueryPerformanceCounter(&sendTime);
+		pSlot->SendTime = sendTime.QuadPart;
 
-		hr = pIoRequest->Send(m_FxIoTarget, 0, 0);		// Send requests asynchronously so that multiple requests are made concurrently.
-		m_nIoRequests++;
+		hr = pSlot->pFxRequest->Send(m_FxIoTarget, 0, 0);		// Send requests asynchronously so that multiple requests are made concurrently.
 	}
-	else
+
+	return hr;
+}
+
+/*
+Send pooled requests until the current depth is reached. Never blocks.
+*/
+void CMyManualQueue::ArmPooledRequests()
+{
+	PTOUCH_IO_SLOT pSlot;
+
+	while (m_IoCredit.TryAcquire())
 	{
-		Trace(TRACE_LEVEL_ERROR, "Error in Sending IOCTL_SELFTEST_GET_INPUT_REPORT.\n");
-		m_IoctlInProgress = false;
-		return FALSE;
+		pSlot = (PTOUCH_IO_SLOT)InterlockedPopEntrySList(&m_FreeSlots);
+		if (NULL == pSlot)
+		{
+			Trace(TRACE_LEVEL_ERROR, "No free request in the pool.\n");
+			m_IoCredit.Release();
+			break;
+		}
+
+		if (FAILED(SendTouchRequest(pSlot)))
+		{
+			Trace(TRACE_LEVEL_ERROR, "Error in Sending IOCTL_SELFTEST_GET_INPUT_REPORT.\n");
+			pSlot->pFxRequest->Reuse(S_OK);
+			InterlockedPushEntrySList(&m_FreeSlots, &pSlot->ListEntry);
+			m_IoCredit.Release();
+			InterlockedExchange(&m_fReadRetry, TRUE);
+			break;
+		}
 	}
+}
 
-	Trace(TRACE_LEVEL_INFORMATION, "ProcessRawTouch()---\n");
-	return TRUE;
+/*
+TRUE if a read failed because the lower device is removed, or because it was canceled while
+the queue is cleaned up. Reads which failed otherwise are retried by _TimerCallback.
+*/
+BOOL CMyManualQueue::IsReadFatal(HRESULT hrStatus)
+{
+	if (hrStatus == HRESULT_FROM_NT(STATUS_DEVICE_REMOVED) ||
+		hrStatus == HRESULT_FROM_NT(STATUS_NO_SUCH_DEVICE) ||
+		hrStatus == HRESULT_FROM_NT(STATUS_DELETE_PENDING) ||
+		hrStatus == HRESULT_FROM_WIN32(ERROR_DEVICE_REMOVED) ||
+		hrStatus == HRESULT_FROM_WIN32(ERROR_DEVICE_NOT_CONNECTED))
+	{
+		InterlockedExchange(&m_fTargetGone, TRUE);
+		return TRUE;
+	}
+
+	if (hrStatus == HRESULT_FROM_NT(STATUS_CANCELLED) ||
+		hrStatus == HRESULT_FROM_WIN32(ERROR_OPERATION_ABORTED))
+	{
+		return m_fStopIo ? TRUE : FALSE;
+	}
+
+	return FALSE;
+}
+
+/*
+The new bounds are applied by the next _TimerCallback.
+*/
+void CMyManualQueue::SetIoDepthBounds(_In_ LONG MinDepth, _In_ LONG MaxDepth)
+{
+	m_IoDepthController.SetBounds(MinDepth, MaxDepth);
+}
+
+/*
+Take the depth bounds from the MinIoDepth and MaxIoDepth values of the device's registry key,
+if the INF or the user set them. The defaults are MIN_IO_REQUEST and MAX_IO_REQUEST.
+*/
+void CMyManualQueue::ReadIoDepthBounds(_In_ IWDFDevice *FxDevice)
+{
+	CComPtr<IWDFNamedPropertyStore> pPropertyStore;
+	PROPVARIANT value;
+	LONG minDepth = MIN_IO_REQUEST;
+	LONG maxDepth = MAX_IO_REQUEST;
+	HRESULT hr;
+
+	hr = FxDevice->RetrieveDevicePropertyStore(NULL, WdfPropertyStoreNormal, &pPropertyStore, NULL);
+	if (FAILED(hr))
+	{
+		Trace(TRACE_LEVEL_ERROR, "Error in ReadIoDepthBounds - RetrieveDevicePropertyStore. hr=0x%x\n", hr);
+		return;
+	}
+
+	PropVariantInit(&value);
+	if (SUCCEEDED(pPropertyStore->GetNamedValue(IO_DEPTH_MIN_VALUE, &value)) && value.vt == VT_UI4)
+	{
+		minDepth = (LONG)value.ulVal;
+	}
+	PropVariantClear(&value);
+
+	if (SUCCEEDED(pPropertyStore->GetNamedValue(IO_DEPTH_MAX_VALUE, &value)) && value.vt == VT_UI4)
+	{
+		maxDepth = (LONG)value.ulVal;
+	}
+	PropVariantClear(&value);
+
+	if (minDepth != MIN_IO_REQUEST || maxDepth != MAX_IO_REQUEST)
+	{
+		Trace(TRACE_LEVEL_INFORMATION, "Touch I/O depth bounds %d..%d from the registry.\n", minDepth, maxDepth);
+		SetIoDepthBounds(minDepth, maxDepth);
+	}
+}
+
+/*
+Let the depth controller close its window and apply the new depth. Only _TimerCallback calls
+this, and the callbacks can overlap, so it's the only caller of CIoCredit::Resize() at a time.
+*/
+void CMyManualQueue::UpdateIoDepth()
+{
+	LARGE_INTEGER now;
+	LONG newDepth;
+
+	if (InterlockedExchange(&m_fUpdatingIoDepth, TRUE) != FALSE)
+	{
+		return;
+	}
+
+	QueryPerformanceCounter(&now);
+	if (m_IoDepthController.Evaluate(now.QuadPart, &newDepth))
+	{
+		Trace(TRACE_LEVEL_INFORMATION, "Touch I/O depth %d -> %d\n", m_IoCredit.GetLimit(), newDepth);
+		m_IoCredit.Resize(newDepth);
+
+#if RESUBMIT_ON_COMPLETION
+		// Send more requests if the depth was raised.
+		if (!m_fTargetGone && !m_fStopIo)
+		{
+			ArmPooledRequests();
+		}
+#endif
+	}
+
+	InterlockedExchange(&m_fUpdatingIoDepth, FALSE);
+}
+
+/*
+Trace how many framework objects the touch read path allocated since the last report.
+This should stay at zero once the request pool is created, except when the pointing mode is toggled.
+*/
+void CMyManualQueue::ReportIoStatistics()
+{
+	ULONGLONG currentTick = GetTickCount64();
+	LONG nAllocations = m_nFxAllocations;
+	CTimerWheel *pWheel = CTimerWheel::Peek();	// Only reported if a gesture engine created it.
+
+	if (m_LastStatsTick != 0 && currentTick > m_LastStatsTick)
+	{
+		ULONGLONG allocationsPerSec = (ULONGLONG)(nAllocations - m_nLastFxAllocations) * 1000 / (currentTick - m_LastStatsTick);
+
+		Trace(TRACE_LEVEL_INFORMATION, "Touch I/O: %I64u allocations/s, depth %d/%d, high-water %d.\n",
+			allocationsPerSec, m_IoCredit.GetInFlight(), m_IoCredit.GetLimit(), m_IoCredit.GetHighWater());
+		Trace(TRACE_LEVEL_INFORMATION, "Touch I/O: batch sizes 1:%d 2:%d 3-4:%d 5-8:%d 9-16:%d 17-32:%d%s\n",
+			m_BatchHistogram[0], m_BatchHistogram[1], m_BatchHistogram[2],
+			m_BatchHistogram[3], m_BatchHistogram[4], m_BatchHistogram[5],
+			m_fBatchIo ? "" : " (single report IOCTL)");
+		Trace(TRACE_LEVEL_INFORMATION, "Touch I/O: %d reordered, %d late, %d dropped reports.\n",
+			m_ReorderBuffer.m_nReordered, m_ReorderBuffer.m_nLate, m_ReorderBuffer.m_nDropped);
+		Trace(TRACE_LEVEL_INFORMATION, "Touch I/O: %d frames, %d partial, %d moves held by the jitter filter.\n",
+			m_FrameAssembler.m_nFrames, m_FrameAssembler.m_nPartialFrames, m_JitterFilter.m_nHeld);
+		Trace(TRACE_LEVEL_INFORMATION, "Touch I/O: ring %u/%u, high-water %d, %d overflows.\n",
+			m_TouchRing.GetOccupancy(), TOUCH_RING_SIZE, m_TouchRing.m_HighWater, m_TouchRing.m_nOverflows);
+		Trace(TRACE_LEVEL_INFORMATION, "Mouse output: %d reports, %d motion events merged, %d button events dropped.\n",
+			m_nOutputReports, m_OutputQueue.m_nMerged, m_OutputQueue.m_nDropped);
+		Trace(TRACE_LEVEL_INFORMATION, "Mouse output wait: button p50 %I64u us p99 %I64u us, motion p50 %I64u us p99 %I64u us.\n",
+			m_OutputQueue.m_ButtonWait.GetPercentile(50), m_OutputQueue.m_ButtonWait.GetPercentile(99),
+			m_OutputQueue.m_MotionWait.GetPercentile(50), m_OutputQueue.m_MotionWait.GetPercentile(99));
+		if (pWheel != NULL)
+		{
+			Trace(TRACE_LEVEL_INFORMATION, "Timer wheel: %d timers fired, %d us latest.\n",
+				pWheel->m_nFired, pWheel->m_MaxLateUs);
+		}
+	}
+
+	if (pWheel != NULL)
+	{
+		CTimerWheel::Release();
+	}
+
+	m_nLastFxAllocations = nAllocations;
+	m_LastStatsTick = currentTick;
 }
 
 HRESULT CMyManualQueue::BlockTouch(UINT32 fBlock)
@@ -1803,6 +2381,8 @@ HRESULT CMyManualQueue::BlockTouch(UINT32 fBlock)
 		return hr;
 	}
 
+	InterlockedIncrement(&m_nFxAllocations);
+
 	// Create a buffer for the read request
 	CComPtr<IWDFMemory> pInputMemory;
 
@@ -1811,6 +2391,11 @@ HRESULT CMyManualQueue::BlockTouch(UINT32 fBlock)
 		pIoRequest,		// Set IoRequest as the parent to be freed when IoRequest is deleted.
 		&pInputMemory);
 
+	if (SUCCEEDED(hr))
+	{
+		InterlockedIncrement(&m_nFxAllocations);
+	}
+
 	hr = m_FxIoTarget->FormatRequestForIoctl(
 		pIoRequest,
 		(ULONG)IOCTL_SELFTEST_BLOCK_TOUCH_REPORT,
@@ -1854,6 +2439,67 @@ void CMyManualQueue::TogglePointingMode()
 }
 
 void CMyManualQueue::CompleteInputReport(CGesture *pGesture)
+{
+	GESTURE_OUTPUT output;
+	MOUSE_OUTPUT_EVENT event;
+	LARGE_INTEGER now;
+
+	Trace(TRACE_LEVEL_VERBOSE, "CompleteInputReport++\n");
+
+	// One consistent snapshot of the gesture output.
+	pGesture->GetOutput(&output);
+
+	event.dx = output.u.MouseX;
+	event.dy = output.u.MouseY;
+	event.dWheel = output.u.Wheel;
+	event.Buttons = output.u.Buttons;
+
+	QueryPerformanceCounter(&now);
+
+	EnterCriticalSection(&m_OutputLock);
+
+	// If no read request is pending, the event waits in the output queue instead of being lost.
+	m_OutputQueue.Add(&event, now.QuadPart);
+	FlushOutputReports();
+
+	LeaveCriticalSection(&m_OutputLock);
+}
+
+/*
+Called when the HID class driver forwarded a read request to the manual queue.
+*/
+void CMyManualQueue::OnReadRequestQueued()
+{
+	EnterCriticalSection(&m_OutputLock);
+	FlushOutputReports();
+	LeaveCriticalSection(&m_OutputLock);
+}
+
+/*
+Complete pending read requests with the queued mouse events. Called with m_OutputLock held.
+*/
+void CMyManualQueue::FlushOutputReports()
+{
+	MOUSE_OUTPUT_EVENT report;
+	LARGE_INTEGER now;
+
+	while (m_OutputQueue.PeekReport(&report))
+	{
+		if (FALSE == CompleteReadRequest(&report))
+		{
+			break;	// No read request is pending.
+		}
+
+		QueryPerformanceCounter(&now);
+		m_OutputQueue.ConsumeReport(&report, now.QuadPart);
+	}
+}
+
+/*
+Complete the next read request in the manual queue with a mouse report.
+Returns FALSE if no read request is pending. The report is consumed otherwise.
+*/
+BOOL CMyManualQueue::CompleteReadRequest(_In_ const MOUSE_OUTPUT_EVENT *pReport)
 {
 	HRESULT hr;
 	IWDFIoRequest *fxRequest = NULL;
@@ -1863,79 +2509,79 @@ void CMyManualQueue::CompleteInputReport(CGesture *pGesture)
 	ULONG readReportSizeCb = sizeof(HIDMINI_INPUT_REPORT);
 	PHIDMINI_INPUT_REPORT readReport;
 
-	Trace(TRACE_LEVEL_VERBOSE, "CompleteInputReport++\n");
-
 	//
 	// see if we have a request in manual queue
 	//
 	hr = m_FxQueue->RetrieveNextRequest(&fxRequest);
-	if (SUCCEEDED(hr)) {
-		IWDFIoRequest2 *fxRequest2;
-
-		Trace(TRACE_LEVEL_VERBOSE, "retrieved read request from manual queue \n");
-
-		hr = fxRequest->QueryInterface(IID_PPV_ARGS(&fxRequest2));
-		if (FAILED(hr)){
-			Trace(TRACE_LEVEL_ERROR, "QueryInterface failed %!hresult!", hr);
-			fxRequest->Complete(hr);
-			fxRequest->Release();
-			return;
-		}
-		fxRequest2->Release();
+	if (FAILED(hr)) {
+		return FALSE;
+	}
 
-		Trace(TRACE_LEVEL_VERBOSE, "EffectiveIoType: %d\n", fxRequest2->GetEffectiveIoType());
+	IWDFIoRequest2 *fxRequest2;
 
-		hr = fxRequest2->RetrieveOutputMemory(&memory);
-		if (FAILED(hr)) {
-			Trace(TRACE_LEVEL_ERROR, "RetrieveINputMemory failed %!hresult!", hr);
-			fxRequest2->Complete(hr);
-			fxRequest2->Release();
-			return;
-		}
+	Trace(TRACE_LEVEL_VERBOSE, "retrieved read request from manual queue \n");
 
-		buffer = memory->GetDataBuffer(&bufferSizeCb);
-		memory->Release();
+	hr = fxRequest->QueryInterface(IID_PPV_ARGS(&fxRequest2));
+	if (FAILED(hr)){
+		Trace(TRACE_LEVEL_ERROR, "QueryInterface failed %!hresult!", hr);
+		fxRequest->Complete(hr);
+		fxRequest->Release();
+		return TRUE;
+	}
+	fxRequest2->Release();
 
-		if (bufferSizeCb < readReportSizeCb)
-		{
-			hr = HRESULT_FROM_NT(STATUS_INVALID_BUFFER_SIZE);
-			Trace(TRACE_LEVEL_ERROR,
-				"%!FUNC! Insufficient read report buffer size %!hresult!", hr);
-		}
-		else
-		{
-			//
-			//Create input report
-			//
-			readReport = (PHIDMINI_INPUT_REPORT)buffer;
-			memset(readReport, 0, sizeof(HIDMINI_INPUT_REPORT));
-			readReport->ReportId = REPORTID_MOUSE;
-			PHID_MOUSE_REPORT hidMouse = NULL;
-
-			hidMouse = &(readReport->MouseReport);
-			hidMouse->InputReport.wXData = pGesture->CurrentMouseX;
-			hidMouse->InputReport.wYData = pGesture->CurrentMouseY;
-			hidMouse->InputReport.bButtons = pGesture->ButtonState;
-			hidMouse->InputReport.cWheel = pGesture->CurrentWheel;
-			//
-			// Report how many bytes were copied
-			//
-			fxRequest2->SetInformation(readReportSizeCb);
-			hr = S_OK;
-		}
+	Trace(TRACE_LEVEL_VERBOSE, "EffectiveIoType: %d\n", fxRequest2->GetEffectiveIoType());
 
+	hr = fxRequest2->RetrieveOutputMemory(&memory);
+	if (FAILED(hr)) {
+		Trace(TRACE_LEVEL_ERROR, "RetrieveINputMemory failed %!hresult!", hr);
 		fxRequest2->Complete(hr);
 		fxRequest2->Release();
+		return TRUE;
 	}
 
-	return;
+	buffer = memory->GetDataBuffer(&bufferSizeCb);
+	memory->Release();
+
+	if (bufferSizeCb < readReportSizeCb)
+	{
+		hr = HRESULT_FROM_NT(STATUS_INVALID_BUFFER_SIZE);
+		Trace(TRACE_LEVEL_ERROR,
+			"%!FUNC! Insufficient read report buffer size %!hresult!", hr);
+	}
+	else
+	{
+		//
+		//Create input report
+		//
+		readReport = (PHIDMINI_INPUT_REPORT)buffer;
+		memset(readReport, 0, sizeof(HIDMINI_INPUT_REPORT));
+		readReport->ReportId = REPORTID_MOUSE;
+		PHID_MOUSE_REPORT hidMouse = NULL;
+
+		hidMouse = &(readReport->MouseReport);
+		hidMouse->InputReport.wXData = (USHORT)pReport->dx;
+		hidMouse->InputReport.wYData = (USHORT)pReport->dy;
+		hidMouse->InputReport.bButtons = pReport->Buttons;
+		hidMouse->InputReport.cWheel = (INT8)pReport->dWheel;
+		//
+		// Report how many bytes were copied
+		//
+		fxRequest2->SetInformation(readReportSizeCb);
+		hr = S_OK;
+
+		InterlockedIncrement(&m_nOutputReports);
+	}
+
+	fxRequest2->Complete(hr);
+	fxRequest2->Release();
+
+	return TRUE;
 }
 
 /*
-The handler is called back when there's a Gesture event. There are two contexts of the thread:
-
-1. Called by the context of the thread that called InjectTouchPoint().
-2. Called by the context of the ShortTap timer thread when the timer is expired.
+The handler is called back when there's a Gesture event. It's always called on the gesture
+thread, either by a touch frame or by the timer work which the thread runs.
 */
 void CALLBACK CMyManualQueue::OnGestureEvent(_Inout_ void *pContext)
 {
@@ -1954,3 +2600,120 @@ void CALLBACK CMyManualQueue::OnGestureEvent(_Inout_ void *pContext)
 	}
 }
 
+/*
+Called back by the gesture timers on their own thread. Only records the work and wakes up
+the gesture thread, which runs it.
+*/
+void CMyManualQueue::OnGesturePost(_Inout_ void *pContext, LONG work)
+{
+	CMyManualQueue *This = (CMyManualQueue *)pContext;
+
+	InterlockedOr(&This->m_GestureWork, work);
+	This->WakeGestureThread();
+}
+
+/*
+Called back by CFrameAssembler on the gesture thread, once per frame.
+The frame goes through the jitter filter on its way to the gesture engine.
+*/
+void CMyManualQueue::OnTouchFrame(_Inout_ void *pContext, _In_ const TOUCH_FRAME *pFrame)
+{
+	CMyManualQueue *This = (CMyManualQueue *)pContext;
+	TOUCH_FRAME frame = *pFrame;
+
+	This->m_JitterFilter.Apply(&frame);
+	This->m_pGesture->InjectTouchFrame(&frame);
+}
+
+//
+// Implementions of CIoDepthController.
+//
+CIoDepthController::CIoDepthController()
+{
+	LARGE_INTEGER frequency;
+
+	QueryPerformanceFrequency(&frequency);
+	m_Frequency = frequency.QuadPart;
+
+	m_MinDepth = MIN_IO_REQUEST;
+	m_MaxDepth = MAX_IO_REQUEST;
+	m_Depth = MIN_IO_REQUEST;
+
+	m_WindowStart = 0;
+	m_Bounds = 0;
+	m_nWindowCompletions = 0;
+	m_WindowLatency = 0;
+}
+
+void CIoDepthController::SetBounds(LONG minDepth, LONG maxDepth)
+{
+	// The depth can never exceed the request pool.
+	if (maxDepth > MAX_IO_REQUEST) maxDepth = MAX_IO_REQUEST;
+	if (maxDepth < 1) maxDepth = 1;
+	if (minDepth < 1) minDepth = 1;
+	if (minDepth > maxDepth) minDepth = maxDepth;
+
+	InterlockedExchange(&m_Bounds, MAKELONG(minDepth, maxDepth));
+}
+
+void CIoDepthController::OnCompletion(LONGLONG sendTime, LONGLONG completeTime)
+{
+	InterlockedIncrement(&m_nWindowCompletions);
+	InterlockedExchangeAdd64(&m_WindowLatency, completeTime - sendTime);
+}
+
+BOOL CIoDepthController::Evaluate(LONGLONG now, _Out_ LONG *pNewDepth)
+{
+	LONG bounds = InterlockedExchange(&m_Bounds, 0);
+	LONG oldDepth = m_Depth;
+	LONGLONG elapsed;
+	LONG nCompletions;
+	LONGLONG latency;
+	LONGLONG rate;
+	LONGLONG avgLatencyUs = 0;
+	LONG depth = m_Depth;
+
+	if (bounds != 0)
+	{
+		m_MinDepth = LOWORD(bounds);
+		m_MaxDepth = HIWORD(bounds);
+	}
+
+	if (m_WindowStart == 0)
+	{	// First evaluation. Start measuring from now.
+		m_WindowStart = now;
+	}
+	else if (now > m_WindowStart)
+	{
+		elapsed = now - m_WindowStart;
+		m_WindowStart = now;
+		nCompletions = InterlockedExchange(&m_nWindowCompletions, 0);
+		latency = InterlockedExchange64(&m_WindowLatency, 0);
+
+		rate = (LONGLONG)nCompletions * m_Frequency / elapsed;						// Reports per second.
+		depth = (LONG)(rate * IO_DEPTH_HEADROOM_MS / 1000) + 1;
+
+		if (nCompletions != 0)
+		{
+			avgLatencyUs = latency * 1000000 / m_Frequency / nCompletions;
+		}
+
+		if (nCompletions != 0 && avgLatencyUs < IO_DEPTH_BACKLOG_US)
+		{	// Requests come back right away. The lower device has reports waiting for us.
+			if (depth < m_Depth * 2) depth = m_Depth * 2;
+		}
+		else if (depth < m_Depth / 2)
+		{	// Shrink gently.
+			depth = m_Depth / 2;
+		}
+
+		Trace(TRACE_LEVEL_VERBOSE, "IoDepth: %I64d reports/s, latency %I64d us, depth %d\n", rate, avgLatencyUs, depth);
+	}
+
+	if (depth < m_MinDepth) depth = m_MinDepth;
+	if (depth > m_MaxDepth) depth = m_MaxDepth;
+
+	m_Depth = depth;
+	*pNewDepth = depth;
+	return (depth != oldDepth) ? TRUE : FALSE;
+}
@@ -20,6 +20,9 @@ Environment:
 #pragma once
 
 #include "internal.h"
+#include "Ingress.h"
+#include "Ring.h"
+#include "Output.h"
 
 #define MILLI_SECOND_TO_NANO100(x)  (x * 1000 * 10)
 
@@ -28,9 +31,282 @@ Environment:
 #define MAX_IO_REQUEST			100	// Maximum Io requests that this driver can make at the same time.
 									// Driver doesn't have to maintain the queue for buffering and simply can send the multiple requests for buffering
 									// the input data from HID upper filter.
+									// This is the size of the request pool and the upper bound of the adaptive depth.
+
+// Bounds and tuning of the adaptive in-flight depth. See CIoDepthController.
+#ifndef MIN_IO_REQUEST
+#define MIN_IO_REQUEST			8	// Lower bound of the number of in-flight requests. Also the initial depth.
+#endif
+#define IO_DEPTH_WINDOW_MS		100	// Measurement window of arrival rate and completion latency.
+#define IO_DEPTH_MIN_VALUE		L"MinIoDepth"	// Registry values of the device which override the bounds.
+#define IO_DEPTH_MAX_VALUE		L"MaxIoDepth"
+#define IO_DEPTH_HEADROOM_MS	50	// Depth is sized to hold this much of the measured arrival rate.
+#define IO_DEPTH_BACKLOG_US		500	// Average completion latency below this means reports are waiting in the lower device.
+
+#define IO_TIMER_PERIOD_MS		IO_DEPTH_WINDOW_MS	// Period of _TimerCallback, which evaluates the depth and retries the failed reads.
+#define IO_STATS_PERIOD_MS		5000	// Period of the I/O statistics report.
+
+#define TOUCH_BATCH_BUCKETS		6	// Batch size histogram buckets: 1, 2, 3-4, 5-8, 9-16, 17-32 reports.
+
+#define TOUCH_RING_SIZE			256	// Reports buffered between the completions and the gesture thread. Power of two.
+
+// When set, OnCompletion() re-arms each completed request straight back to the lower device
+// and the interrupt thread only primes the pipeline, instead of looping on ProcessRawTouch().
+#ifndef RESUBMIT_ON_COMPLETION
+#define RESUBMIT_ON_COMPLETION	1
+#endif
 
 class CGesture;
 
+//
+// Preallocated request/buffer pair used to read touch reports from the lower
+// device. The pool is created once in CMyManualQueue::Initialize() and every
+// slot is recycled with IWDFIoRequest2::Reuse() instead of being deleted.
+//
+typedef struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) _TOUCH_IO_SLOT
+{
+	SLIST_ENTRY		ListEntry;		// Link in the free slot list. Must be the first member.
+	IWDFIoRequest2	*pFxRequest;	// Weak reference. Parented to the device.
+	IWDFMemory		*pFxMemory;		// Weak reference. Parented to pFxRequest.
+	LONGLONG		SendTime;		// QueryPerformanceCounter() value when the request was sent.
+	ULONG			IoctlCode;		// IOCTL the request was last sent with.
+} TOUCH_IO_SLOT, *PTOUCH_IO_SLOT;
+
+//
+// Credit counter for in-flight touch read requests.
+// Acquire() and Release() are a single interlocked operation when uncontended.
+// The semaphore is only signaled when the submitter is actually waiting for a credit,
+// so no wakeup can be lost and the in-flight count is exact.
+//
+// The number of credits can be changed while requests are in flight. Raising it hands
+// out new credits immediately. Lowering it takes back free credits first and records
+// the rest as debt, which is paid back by retiring requests as they complete.
+//
+class CIoCredit
+{
+private:
+	volatile LONG	m_Available;	// Credits left. Negative while the submitter waits for one.
+	volatile LONG	m_Debt;			// Credits to retire on completion after the limit was lowered.
+	volatile LONG	m_InFlight;		// Requests currently owned by the lower device.
+	volatile LONG	m_HighWater;	// Highest m_InFlight observed.
+	LONG			m_Limit;		// Total number of credits.
+	HANDLE			m_hWaitSemaphore;
+
+	void NoteAcquired()
+	{
+		LONG inFlight = InterlockedIncrement(&m_InFlight);
+		LONG highWater = m_HighWater;
+
+		while (inFlight > highWater)
+		{
+			LONG prev = InterlockedCompareExchange(&m_HighWater, inFlight, highWater);
+			if (prev == highWater)
+			{
+				break;
+			}
+			highWater = prev;
+		}
+	}
+
+public:
+	CIoCredit(LONG nCredits) :
+		m_Available(nCredits),
+		m_Debt(0),
+		m_InFlight(0),
+		m_HighWater(0),
+		m_Limit(nCredits)
+	{
+		m_hWaitSemaphore = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+	}
+
+	~CIoCredit()
+	{
+		CloseHandle(m_hWaitSemaphore);
+	}
+
+	// Take a credit, waiting for a completion if all of them are in flight.
+	void Acquire()
+	{
+		if (InterlockedDecrement(&m_Available) < 0)
+		{
+			WaitForSingleObject(m_hWaitSemaphore, INFINITE);
+		}
+
+		NoteAcquired();
+	}
+
+	// Take a credit only if one is free right now.
+	BOOL TryAcquire()
+	{
+		LONG available = m_Available;
+
+		while (available > 0)
+		{
+			LONG prev = InterlockedCompareExchange(&m_Available, available - 1, available);
+			if (prev == available)
+			{
+				NoteAcquired();
+				return TRUE;
+			}
+			available = prev;
+		}
+
+		return FALSE;
+	}
+
+	// Drop the credit of a completed request if the limit was lowered.
+	// Returns TRUE if the request was retired and must not be sent again.
+	BOOL Retire()
+	{
+		LONG debt = m_Debt;
+
+		while (debt > 0)
+		{
+			LONG prev = InterlockedCompareExchange(&m_Debt, debt - 1, debt);
+			if (prev == debt)
+			{
+				InterlockedDecrement(&m_InFlight);
+				return TRUE;
+			}
+			debt = prev;
+		}
+
+		return FALSE;
+	}
+
+	// Give back the credit of a request which is no longer in flight.
+	void Release()
+	{
+		if (Retire())
+		{
+			return;
+		}
+
+		InterlockedDecrement(&m_InFlight);
+
+		if (InterlockedIncrement(&m_Available) <= 0)
+		{	// The submitter is waiting for this credit.
+			ReleaseSemaphore(m_hWaitSemaphore, 1, NULL);
+		}
+	}
+
+	// Change the total number of credits. Only one thread may call this at a time.
+	void Resize(LONG nLimit)
+	{
+		LONG delta = nLimit - m_Limit;
+
+		m_Limit = nLimit;
+
+		if (delta < 0)
+		{
+			LONG excess = -delta;
+			LONG available = m_Available;
+
+			// Take back free credits first.
+			while (excess > 0 && available > 0)
+			{
+				LONG take = min(available, excess);
+				LONG prev = InterlockedCompareExchange(&m_Available, available - take, available);
+				if (prev == available)
+				{
+					excess -= take;
+					available -= take;
+				}
+				else
+				{
+					available = prev;
+				}
+			}
+
+			// The rest is retired when the requests complete.
+			if (excess > 0)
+			{
+				InterlockedExchangeAdd(&m_Debt, excess);
+			}
+			return;
+		}
+
+		// Cancel the debt which is not paid back yet.
+		while (delta > 0)
+		{
+			LONG debt = m_Debt;
+			if (debt <= 0)
+			{
+				break;
+			}
+
+			LONG cancel = min(debt, delta);
+			if (InterlockedCompareExchange(&m_Debt, debt - cancel, debt) == debt)
+			{
+				delta -= cancel;
+			}
+		}
+
+		if (delta > 0)
+		{
+			LONG prev = InterlockedExchangeAdd(&m_Available, delta);
+			if (prev < 0)
+			{	// Wake up the waiters which the new credits are for.
+				ReleaseSemaphore(m_hWaitSemaphore, min(-prev, delta), NULL);
+			}
+		}
+	}
+
+	LONG GetLimit()
+	{
+		return m_Limit;
+	}
+
+	LONG GetInFlight()
+	{
+		return m_InFlight;
+	}
+
+	LONG GetHighWater()
+	{
+		return m_HighWater;
+	}
+};
+
+//
+// Chooses the number of in-flight touch read requests from the measured arrival rate and
+// completion latency of the requests, within [MinDepth, MaxDepth].
+//
+// The depth is sized to buffer IO_DEPTH_HEADROOM_MS of the arrival rate. If requests come back
+// almost immediately, reports are piling up in the lower device and the depth is doubled.
+// Otherwise the depth shrinks by at most half per window so that a short pause doesn't
+// starve the next burst, and keeps shrinking while no report arrives.
+//
+// The completions only account their latency. The window is closed by Evaluate(), which the
+// periodic timer calls, so the depth also follows the pad while it's idle.
+//
+class CIoDepthController
+{
+private:
+	LONG				m_MinDepth;
+	LONG				m_MaxDepth;
+	LONG				m_Depth;
+	LONGLONG			m_Frequency;			// QueryPerformanceFrequency()
+	LONGLONG			m_WindowStart;			// 0 until the first evaluation.
+
+	volatile LONG		m_Bounds;				// MAKELONG(minDepth, maxDepth) not applied yet, or 0.
+	volatile LONG		m_nWindowCompletions;
+	volatile LONGLONG	m_WindowLatency;		// Sum of completion latencies in the window.
+
+public:
+	CIoDepthController();
+
+	// Any thread may call this. The bounds take effect at the next Evaluate().
+	void SetBounds(LONG minDepth, LONG maxDepth);
+
+	// Account a completed request. Any thread may call this.
+	void OnCompletion(LONGLONG sendTime, LONGLONG completeTime);
+
+	// Close the window at now. Returns TRUE with the new depth when it should change.
+	// Only one thread may call this at a time.
+	BOOL Evaluate(LONGLONG now, _Out_ LONG *pNewDepth);
+};
+
 //
 // Class for the queue callbacks.
 // It implements
@@ -244,12 +520,49 @@ private:
 
 	bool            m_PointingMode;	// TRUE when Pointing mode. Set to FALSE when Touch mode.
 	bool            m_IoctlInProgress;
-	int				m_nIoRequests;		// Number of pending IO requests
-	HANDLE			m_hCompletionEvent;	// event handle for Waiting for Request to be completed.
+	CIoCredit		m_IoCredit;		// In-flight accounting of the requests sent to the lower device.
+	CIoDepthController	m_IoDepthController;	// Adjusts the number of credits of m_IoCredit.
+
+	TOUCH_IO_SLOT	m_IoSlots[MAX_IO_REQUEST];	// Request pool for IOCTL_SELFTEST_GET_INPUT_REPORT.
+	SLIST_HEADER	m_FreeSlots;				// Slots which are not sent to the lower device.
+
+	volatile LONG	m_fBatchIo;		// TRUE while the lower device accepts IOCTL_SELFTEST_GET_INPUT_REPORT_BATCH.
+	volatile LONG	m_BatchHistogram[TOUCH_BATCH_BUCKETS];	// Number of completions per batch size bucket.
+
+	volatile LONG	m_nFxAllocations;		// Framework objects allocated for the touch read path so far.
+	LONG			m_nLastFxAllocations;	// m_nFxAllocations at the last statistics report.
+	ULONGLONG		m_LastStatsTick;		// Tick of the last statistics report.
+	volatile LONG	m_nTimerTicks;			// Calls of _TimerCallback so far.
+	volatile LONG	m_fUpdatingIoDepth;		// TRUE while a _TimerCallback evaluates the depth.
+
+	volatile LONG	m_fReadRetry;	// Set when a read failed and was not re-armed. _TimerCallback sends it again.
+	volatile LONG	m_fTargetGone;	// Set when a read failed because the lower device is removed. Reads are not retried any more.
+	volatile LONG	m_fStopIo;		// Set on cleanup. Reads are not retried any more.
 
 	// Indicate that toggling of touch blocking is detected, it'll be pending until the UP event is received.
 	bool            m_TogglePending;
 
+	//
+	// Completions only copy the reports into m_TouchRing, concurrently and without a lock. The
+	// gesture thread drains it and owns the ingress stages and the gesture engine.
+	//
+	CMpscRing<HID_TOUCH_REPORT, TOUCH_RING_SIZE>	m_TouchRing;
+	HANDLE			m_GestureThread;
+	HANDLE			m_hGestureEvent;	// Wakes up the gesture thread.
+	HANDLE			m_hIngressTimer;	// Wakes up the gesture thread when a held report or frame is due.
+	volatile LONG	m_fGestureWaiting;	// TRUE while the gesture thread sleeps on m_hGestureEvent.
+	volatile LONG	m_GestureWork;		// GESTURE_WORK_* bits posted by the gesture timers.
+	volatile LONG	m_fStopGesture;		// Set on cleanup to end the gesture thread.
+
+	CReorderBuffer	m_ReorderBuffer;	// Restores timestamp order of the completed reports.
+	CFrameAssembler	m_FrameAssembler;	// Groups the ordered reports into frames for the gesture engine.
+	CJitterFilter	m_JitterFilter;		// Smooths the contact positions of the frames.
+	LONGLONG		m_QpcFrequency;		// QueryPerformanceFrequency()
+
+	CRITICAL_SECTION	m_OutputLock;	// Serializes the gesture events and the arrival of read requests.
+	COutputQueue	m_OutputQueue;		// Mouse events waiting for IOCTL_HID_READ_REPORT.
+	volatile LONG	m_nOutputReports;	// Read requests completed with a mouse report.
+
 	CGesture		*m_pGesture;
 
 private:
@@ -258,17 +571,51 @@ private:
         ) : 
         m_FxQueue(NULL),
         m_Timer(NULL),
-		m_nIoRequests(0),
+		m_IoCredit(MIN_IO_REQUEST),
+		m_fBatchIo(TRUE),
+		m_nFxAllocations(0),
+		m_nLastFxAllocations(0),
+		m_LastStatsTick(0),
+		m_nTimerTicks(0),
+		m_fUpdatingIoDepth(FALSE),
+		m_fReadRetry(FALSE),
+		m_fTargetGone(FALSE),
+		m_fStopIo(FALSE),
+		m_nOutputReports(0),
 		m_PointingMode(1),
 		m_TogglePending(0),
         m_Device(Device)
     {
-		m_hCompletionEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+		LARGE_INTEGER frequency;
+
+		ZeroMemory(m_IoSlots, sizeof(m_IoSlots));
+		ZeroMemory((PVOID)m_BatchHistogram, sizeof(m_BatchHistogram));
+		InitializeSListHead(&m_FreeSlots);
+
+		InitializeCriticalSection(&m_OutputLock);
+		m_GestureThread = NULL;
+		m_hGestureEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+		// The ingress deadlines are a few ms away, so they need a timer which isn't held to the
+		// system timer tick. Fall back to a regular one on systems which don't have it.
+		m_hIngressTimer = CreateWaitableTimerEx(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		if (m_hIngressTimer == NULL)
+		{
+			m_hIngressTimer = CreateWaitableTimer(NULL, FALSE, NULL);
+		}
+		m_fGestureWaiting = FALSE;
+		m_GestureWork = 0;
+		m_fStopGesture = FALSE;
+
+		QueryPerformanceFrequency(&frequency);
+		m_QpcFrequency = frequency.QuadPart;
     }
 
     virtual ~CMyManualQueue()
     {
-		CloseHandle(m_hCompletionEvent);
+		CloseHandle(m_hGestureEvent);
+		CloseHandle(m_hIngressTimer);
+		DeleteCriticalSection(&m_OutputLock);
     }
 
     //
@@ -280,6 +627,11 @@ private:
         _In_ IWDFDevice *FxDevice
         );
 
+    HRESULT
+    CreateRequestPool(
+        _In_ IWDFDevice *FxDevice
+        );
+
 public:
 
     IWDFIoQueue*
@@ -302,6 +654,26 @@ public:
         return m_Timer;
     }
 
+    LONG
+    GetIoDepth(
+        )
+    {
+        return m_IoCredit.GetInFlight();
+    }
+
+    LONG
+    GetIoDepthHighWater(
+        )
+    {
+        return m_IoCredit.GetHighWater();
+    }
+
+    void
+    SetIoDepthBounds(
+        _In_ LONG MinDepth,
+        _In_ LONG MaxDepth
+        );
+
     //
     // The factory method used to create an instance of this class
     //
@@ -389,14 +761,32 @@ public:
         );
 
 	static DWORD WINAPI InterruptThread( LPVOID lpParam );
+	static DWORD WINAPI GestureThread( LPVOID lpParam );
 
 	BOOL DoMainIo();
 	BOOL ProcessRawTouch();
+	HRESULT SendTouchRequest(_In_ PTOUCH_IO_SLOT pSlot);
+	void ArmPooledRequests();
+	void UpdateIoDepth();
+	void ReadIoDepthBounds(_In_ IWDFDevice *FxDevice);
+	BOOL IsReadFatal(HRESULT hrStatus);
+	void ProcessTouchReports(_In_ PTOUCH_IO_SLOT pSlot, _In_ ULONG_PTR Information);
+	void DoGestureLoop();
+	void WakeGestureThread();
+	void DeliverTouchReports(_In_reads_(nReports) PHID_TOUCH_REPORT pReports, UINT32 nReports, LONGLONG now);
+	LONGLONG GetIngressDeadline();
+	void WaitForGestureWork(LONGLONG now);
+	void ReportIoStatistics();
 
 	void TogglePointingMode();
 	HRESULT BlockTouch(UINT32 fBlock);	// Block touch driver if fBlock input is TRUE.
 	void CompleteInputReport(CGesture *pGesture);
+	void OnReadRequestQueued();
+	void FlushOutputReports();
+	BOOL CompleteReadRequest(_In_ const MOUSE_OUTPUT_EVENT *pReport);
 	static void OnGestureEvent(_Inout_ void *pContext); // Callback Gesture event.
+	static void OnGesturePost(_Inout_ void *pContext, LONG work); // Callback of the gesture timers.
+	static void OnTouchFrame(_Inout_ void *pContext, _In_ const TOUCH_FRAME *pFrame); // Callback of CFrameAssembler.
 
 };
 